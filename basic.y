@@ -35,6 +35,7 @@ static void dump_tokens (unsigned short *);
 }
 /* BASIC keywords */
 %token BYE
+%token CON
 %token CONTINUE
 %token DATA
 %token DEF
@@ -43,26 +44,33 @@ static void dump_tokens (unsigned short *);
 %token END
 %token ERROR
 %token EXPRESSIONS
+%token FAST
+%token ARRAYFILE	/* `FILE', which is already the name of a C type */
 %token FOR
 %token GOSUB
 %token GOTO
 %token _GOTO_	/* Implied GOTO for IF / THEN [ ELSE ] statements */
 %token GRAMMAR
+%token IDN
 %token IF
 %token INPUT
+%token INV
 %token LET
 %token _LET_	/* Implied `LET' */
 %token LINES
 %token LIST
 %token LOAD
+%token MAT
 %token NEW
 %token NEXT
 %token OFF
 %token ON
 %token PARSER
 %token PAUSE
+%token PRESERVE
 %token PRINT
 %token READ
+%token REDIM
 %token REM
 %token <string> RESTOFLINE
 %token RESTORE
@@ -76,6 +84,8 @@ static void dump_tokens (unsigned short *);
 %token _THEN_	/* Implied THEN for IF / ... [ ELSE ] statements */
 %token TO
 %token TRACE
+%token TRN
+%token ZER
 /* Arithmetic operators */
 %left OR
 %left AND
@@ -431,6 +441,14 @@ statement: assignment
 	  /* Allocate a new statement */
 	  $<tokens>$ = add_tokens ("tts", LOAD, STRING, $<string>2);
 	}
+    | MAT IDENTIFIER '=' matexpression /* Matrix arithmetic */
+	{
+	  if (tracing & TRACE_GRAMMAR)
+	    fprintf (stderr, "Matrix %s assigned\n",
+		     name_table[$<integer>2]->contents);
+	  $<tokens>$ = add_tokens ("tttt*", MAT, IDENTIFIER, $<integer>2,
+				   '=', $<tokens>4);
+	}
     | NEW               /* Erase the current program from memory */
 	{
 	  if (tracing & TRACE_GRAMMAR)
@@ -487,6 +505,13 @@ statement: assignment
 	  /* Make a statement out of the list */
 	  $<tokens>$ = add_tokens ("t*", READ, $<tokens>2);
 	}
+    | REDIM PRESERVE dimlist /* Resize arrays, keeping their elements */
+	{
+	  if (tracing & TRACE_GRAMMAR)
+	    fprintf (stderr, "Array variable resized\n");
+	  /* Convert the variable token list into a statement */
+	  $<tokens>$ = add_tokens ("tt*", REDIM, PRESERVE, $<tokens>3);
+	}
     | REM RESTOFLINE    /* Comment -- store in program, but do nothing */
 	{
 	  if (tracing & TRACE_GRAMMAR)
@@ -525,6 +550,13 @@ statement: assignment
 	  /* Allocate a new statement */
 	  $<tokens>$ = add_tokens ("t", RUN);
 	}
+    | RUN FAST          /* Execute program with the bytecode engine */
+	{
+	  if (tracing & TRACE_GRAMMAR)
+	    fprintf (stderr, "Run the compiled program from the beginning\n");
+	  /* Allocate a new statement */
+	  $<tokens>$ = add_tokens ("tt", RUN, FAST);
+	}
     | SAVE STRING       /* List the entire program to a file */
 	{
 	  if (tracing & TRACE_GRAMMAR)
@@ -1233,6 +1265,66 @@ strfuncdecl: STRINGIDENTIFIER '(' arglist ')'
     }
     ;
 
+matexpression: IDENTIFIER
+    {
+      $<tokens>$ = add_tokens ("tt", IDENTIFIER, $<integer>1);
+    }
+    | IDENTIFIER '+' IDENTIFIER
+    {
+      $<tokens>$ = add_tokens ("ttttt", IDENTIFIER, $<integer>1,
+			       '+', IDENTIFIER, $<integer>3);
+    }
+    | IDENTIFIER '-' IDENTIFIER
+    {
+      $<tokens>$ = add_tokens ("ttttt", IDENTIFIER, $<integer>1,
+			       '-', IDENTIFIER, $<integer>3);
+    }
+    | IDENTIFIER '*' IDENTIFIER
+    {
+      $<tokens>$ = add_tokens ("ttttt", IDENTIFIER, $<integer>1,
+			       '*', IDENTIFIER, $<integer>3);
+    }
+    | '(' numexpression ')' '*' IDENTIFIER  /* Multiply by a number */
+    {
+      $<tokens>$ = add_tokens ("tt#tttt", '(', NUMEXPR, $<tokens>2,
+			       ')', '*', IDENTIFIER, $<integer>5);
+    }
+    | TRN '(' IDENTIFIER ')'
+    {
+      $<tokens>$ = add_tokens ("ttttt", TRN, '(', IDENTIFIER,
+			       $<integer>3, ')');
+    }
+    | INV '(' IDENTIFIER ')'
+    {
+      $<tokens>$ = add_tokens ("ttttt", INV, '(', IDENTIFIER,
+			       $<integer>3, ')');
+    }
+    | ZER
+    {
+      $<tokens>$ = add_tokens ("t", ZER);
+    }
+    | ZER '(' arrayindex ')'
+    {
+      $<tokens>$ = add_tokens ("tt*t", ZER, '(', $<tokens>3, ')');
+    }
+    | CON
+    {
+      $<tokens>$ = add_tokens ("t", CON);
+    }
+    | CON '(' arrayindex ')'
+    {
+      $<tokens>$ = add_tokens ("tt*t", CON, '(', $<tokens>3, ')');
+    }
+    | IDN
+    {
+      $<tokens>$ = add_tokens ("t", IDN);
+    }
+    | IDN '(' arrayindex ')'
+    {
+      $<tokens>$ = add_tokens ("tt*t", IDN, '(', $<tokens>3, ')');
+    }
+    ;
+
 dimdecl: IDENTIFIER '(' arrayindex ')'
     {
       if (tracing & TRACE_GRAMMAR)
@@ -1241,6 +1333,15 @@ dimdecl: IDENTIFIER '(' arrayindex ')'
       $<tokens>$ = add_tokens ("ttt*t", IDENTIFIER,
 			       $<integer>1, '(', $<tokens>3, ')');
     }
+    | IDENTIFIER '(' arrayindex ')' ARRAYFILE STRING
+    {
+      if (tracing & TRACE_GRAMMAR)
+	fprintf (stderr, "Declare numeric array %s in file \"%s\"\n",
+		 name_table[$<integer>1]->contents, $<string>6->contents);
+      $<tokens>$ = add_tokens ("ttt*ttts", IDENTIFIER,
+			       $<integer>1, '(', $<tokens>3, ')',
+			       ARRAYFILE, STRING, $<string>6);
+    }
     | STRINGIDENTIFIER '(' arrayindex ')'
     {
       if (tracing & TRACE_GRAMMAR)
@@ -1370,6 +1471,8 @@ add_tokens (const char *pattern, ...)
 	    struct string_value *string = va_arg (vp, struct string_value *);
 	    memcpy (tp, string, WALIGN (sizeof (struct string_value)
 					+ string->length + 1));
+	    /* Constants in the program are shared without being copied */
+	    ((struct string_value *) tp)->refs = STATIC_STRING;
 	    tp = (unsigned short *) &((char *) tp)
 	      [WALIGN (sizeof (struct string_value) + string->length + 1)];
 	    /* Free the string */
@@ -0,0 +1,965 @@
+/* Bytecode compiler and stack machine for `RUN FAST'
+ *
+ * Each program line is compiled the first time it is executed into a
+ * single block of code, with each statement's code starting at the
+ * entry in the line's statement table.  Numeric expressions are
+ * compiled into postfix operations on a stack of doubles, with the
+ * constants already decoded and variables already resolved to their
+ * index in the variable table.  Anything the compiler doesn't
+ * understand is left to the tree-walking interpreter: operands
+ * through OP_EVAL, and whole statements through OP_COMMAND.
+ *
+ * The token stream stays the source of truth for LIST and SAVE;
+ * the compiled code is discarded whenever the line's statement
+ * table is rebuilt, which happens after any change to the program.
+ *
+ * The same compiler also turns every numeric expression into postfix
+ * code as soon as its line is entered, which the interpreter uses in
+ * place of the phantom parentheses of the infix tokens. */
+
+#include <float.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tables.h"
+#include "basic.tab.h"
+
+
+/* Maximum depth of the expression stack.  Statements whose
+ * expressions would need more are left to the interpreter. */
+#define VM_STACK_SIZE 64
+/* Number of times an expression must be evaluated
+ * before we compile it to native code */
+#define JIT_THRESHOLD 100
+
+/* Code buffer used while compiling a line */
+static union bytecode *code_buffer = NULL;
+static size_t code_size = 0;	/* Number of words allocated	*/
+static size_t code_used;	/* Number of words compiled	*/
+/* Depth of the expression stack at this point in the code */
+static int stack_depth, max_stack_depth;
+
+
+/* Add a word to the code buffer */
+static union bytecode *
+emit (void)
+{
+  if (code_used >= code_size)
+    {
+      code_size = code_size ? (code_size * 2) : 64;
+      code_buffer = (union bytecode *) realloc
+	(code_buffer, sizeof (union bytecode) * code_size);
+    }
+  return &code_buffer[code_used++];
+}
+
+/* Add an operation to the code buffer, keeping track of what
+ * it does to the depth of the expression stack */
+static void
+emit_op (enum opcode op, int stack_change)
+{
+  emit ()->op = op;
+  stack_depth += stack_change;
+  if (stack_depth > max_stack_depth)
+    max_stack_depth = stack_depth;
+}
+
+/* Skip over an argument or index list and the closing parenthesis.
+ * The token pointer must be at the opening parenthesis. */
+static int
+skip_arguments (unsigned short **tpp)
+{
+  unsigned short *tp = *tpp;
+
+  if (*(++tp) != ITEMLIST)
+    return -1;
+  ++tp;
+  tp = (unsigned short *) &((char *) tp)
+    [((struct list_header *) tp)->length];
+  if (*tp++ != ')')
+    return -1;
+  *tpp = tp;
+  return 0;
+}
+
+/* Skip over a string expression, as eval_string() would read it.
+ * Returns 0 if successful, -1 if we don't recognize it. */
+static int
+skip_string (unsigned short **tpp)
+{
+  unsigned short *tp = *tpp;
+
+  if (*tp == STREXPR)
+    ++tp;
+  while (1)
+    {
+      switch ((int) *tp)
+	{
+	case STRING:
+	  ++tp;
+	  tp = (unsigned short *) &((char *) tp)
+	    [WALIGN (sizeof (struct string_value)
+		     + ((struct string_value *) tp)->length + 1)];
+	  break;
+
+	case STRINGIDENTIFIER:
+	  tp += 2;
+	  if (HAS_ARGUMENTS (tp) && skip_arguments (&tp))
+	    return -1;
+	  break;
+
+	default:
+	  return -1;
+	}
+
+      /* Check for concatenation */
+      if (*tp != '+')
+	break;
+      ++tp;
+    }
+  *tpp = tp;
+  return 0;
+}
+
+static int compile_number (unsigned short **tpp);
+static int compile_numexpr (unsigned short **tpp);
+static union bytecode *run_code (union bytecode *pc, double *value);
+
+/* Compile a call to a numeric built-in function with numeric
+ * arguments.  The token pointer must be at the opening parenthesis.
+ * Returns 0 if successful, -1 if the call has to be interpreted. */
+static int
+compile_call (struct fndef *fn, unsigned short **tpp)
+{
+  unsigned short *tp = *tpp;
+  struct list_header *arg_list;
+  struct list_item *lp;
+  int i;
+
+  if ((fn == NULL) || (fn->built_in == NULL)
+      || fn->type || fn->argtypes)
+    return -1;
+  if (tp[1] != ITEMLIST)
+    return -1;
+  arg_list = (struct list_header *) &tp[2];
+  if (arg_list->num_items != fn->num_args)
+    return -1;
+
+  lp = &arg_list->item[0];
+  for (i = 0; i < arg_list->num_items; i++)
+    {
+      tp = &lp->tokens[0];
+      switch (*tp)
+	{
+	case IDENTIFIER:
+	case INTEGER:
+	case FLOATINGPOINT:
+	case NUMEXPR:
+	  break;
+	default:
+	  return -1;
+	}
+      if (compile_number (&tp))
+	return -1;
+      /* The argument must be the entire list item */
+      if (tp != (unsigned short *) &((char *) lp)[lp->length])
+	return -1;
+      /* Skip the argument delimiter (',') */
+      lp = (struct list_item *) &tp[1];
+    }
+
+  emit_op (OP_CALL, 1 - arg_list->num_items);
+  emit ()->built_in = fn->built_in;
+  emit ()->index = arg_list->num_items;
+  return skip_arguments (tpp);
+}
+
+/* Compile a numeric operand, as eval_number() would evaluate it.
+ * The token pointer is advanced to the next token after the operand.
+ * Returns 0 if successful, -1 if the operand can't be compiled. */
+static int
+compile_number (unsigned short **tpp)
+{
+  unsigned short *tp = *tpp;
+  unsigned short *start;
+  struct fndef *fn;
+  size_t saved_used;
+  int saved_depth;
+
+  if (*tp == NUMEXPR)
+    ++tp;
+
+  switch ((int) *tp)
+    {
+    case INTEGER:
+      ++tp;
+      emit_op (OP_CONST, 1);
+      emit ()->number = (double) *((unsigned long *) tp);
+      *tpp = (unsigned short *) &((unsigned long *) tp)[1];
+      return 0;
+
+    case FLOATINGPOINT:
+      ++tp;
+      emit_op (OP_CONST, 1);
+      emit ()->number = *((double *) tp);
+      *tpp = (unsigned short *) &((double *) tp)[1];
+      return 0;
+
+    case IDENTIFIER:
+      start = tp;
+      tp += 2;
+      if (!HAS_ARGUMENTS (tp))
+	{
+	  /* A simple variable */
+	  emit_op (OP_LOAD, 1);
+	  emit ()->index = start[1];
+	  *tpp = tp;
+	  return 0;
+	}
+      /* Built-in functions can be called directly */
+      fn = find_function (start[1]);
+      saved_used = code_used;
+      saved_depth = stack_depth;
+      if (compile_call (fn, &tp) == 0)
+	{
+	  *tpp = tp;
+	  return 0;
+	}
+      code_used = saved_used;
+      stack_depth = saved_depth;
+      if (skip_arguments (&tp))
+	return -1;
+      /* Other functions and arrays are bound to their function table
+       * entry, which stays put until the table generation changes;
+       * anything else is left to the interpreter. */
+      if ((fn != NULL) && !fn->type
+	  && (check_arguments (fn, (struct list_header *) &start[4]) == 0))
+	{
+	  emit_op (OP_FN, 1);
+	  emit ()->index = fn - function_table;
+	  emit ()->tokens = start;
+	}
+      else
+	{
+	  emit_op (OP_EVAL, 1);
+	  emit ()->tokens = start;
+	}
+      *tpp = tp;
+      return 0;
+
+    case '(':
+      ++tp;
+      if (compile_number (&tp))
+	return -1;
+      if (*tp++ != ')')
+	return -1;
+      *tpp = tp;
+      return 0;
+
+    case '{':
+      start = tp;
+      ++tp;
+      if (*tp == STREXPR)
+	{
+	  /* String comparisons are left to the interpreter */
+	  if (skip_string (&tp))
+	    return -1;
+	  ++tp;
+	  if (skip_string (&tp))
+	    return -1;
+	  if (*tp++ != '}')
+	    return -1;
+	  emit_op (OP_EVAL, 1);
+	  emit ()->tokens = start;
+	  *tpp = tp;
+	  return 0;
+	}
+      if (*tp == NUMEXPR)
+	++tp;
+      if (compile_numexpr (&tp))
+	return -1;
+      if (*tp++ != '}')
+	return -1;
+      *tpp = tp;
+      return 0;
+    }
+
+  return -1;
+}
+
+/* If the code for an operation only has constant operands,
+ * replace it with the result. */
+static void
+fold_constants (size_t start)
+{
+  union bytecode *pc;
+  double value;
+
+  for (pc = &code_buffer[start]; pc < &code_buffer[code_used]; pc++)
+    {
+      if (pc->op == OP_CONST)
+	pc++;
+      else if ((pc->op < OP_ADD) || (pc->op > OP_OR))
+	return;
+    }
+  emit ()->op = OP_VALUE;
+  run_code (&code_buffer[start], &value);
+  code_used = start;
+  emit ()->op = OP_CONST;
+  emit ()->number = value;
+}
+
+/* Replace an operation with a constant right operand by a cheaper one
+ * if it gives exactly the same result.  RIGHT is where the code for
+ * the operand starts.  Returns 0 if the operation was emitted. */
+static int
+reduce_strength (enum opcode op, size_t right)
+{
+  double operand, reciprocal;
+  int exponent;
+
+  if ((code_used != right + 2) || (code_buffer[right].op != OP_CONST))
+    return -1;
+  operand = code_buffer[right + 1].number;
+
+  switch (op)
+    {
+    case OP_POW:
+      /* Squares by multiplication, which rounds once just as pow()
+       * does.  A cube would round twice and could differ from pow()
+       * in the last bit, so it is left alone. */
+      if (operand != 2.0)
+	return -1;
+      code_used = right;
+      stack_depth--;
+      emit_op (OP_DUP, 1);
+      emit_op (OP_MUL, -1);
+      return 0;
+
+    case OP_DIV:
+      /* Multiply by the reciprocal, but only when it's exact, so
+       * that (for example) 49/49 is still exactly 1. */
+      reciprocal = 1.0 / operand;
+      if ((frexp (operand, &exponent) != 0.5) || !isnormal (reciprocal))
+	return -1;
+      code_buffer[right + 1].number = reciprocal;
+      emit_op (OP_MUL, -1);
+      return 0;
+
+    default:
+      break;
+    }
+
+  return -1;
+}
+
+/* Compile a unary or binary numeric expression,
+ * as eval_numexpr() would evaluate it. */
+static int
+compile_numexpr (unsigned short **tpp)
+{
+  unsigned short *tp = *tpp;
+  size_t start = code_used, right;
+  enum opcode op;
+
+  if ((*tp == NEG) || (*tp == NOT))
+    {
+      op = (*tp++ == NEG) ? OP_NEG : OP_NOT;
+      if (compile_number (&tp))
+	return -1;
+      emit_op (op, 0);
+      fold_constants (start);
+      *tpp = tp;
+      return 0;
+    }
+
+  if (compile_number (&tp))
+    return -1;
+  switch ((int) *tp++)
+    {
+    case '+': op = OP_ADD; break;
+    case '-': op = OP_SUB; break;
+    case '*': op = OP_MUL; break;
+    case '/': op = OP_DIV; break;
+    case '^': op = OP_POW; break;
+    case '=': op = OP_EQ; break;
+    case NOTEQ: op = OP_NE; break;
+    case '<': op = OP_LT; break;
+    case '>': op = OP_GT; break;
+    case LESSEQ: op = OP_LE; break;
+    case GRTREQ: op = OP_GE; break;
+    case AND: op = OP_AND; break;
+    case OR: op = OP_OR; break;
+    default: return -1;
+    }
+  right = code_used;
+  if (compile_number (&tp))
+    return -1;
+  /* Constants on both sides are folded rather than reduced */
+  if (((right == start + 2) && (code_buffer[start].op == OP_CONST))
+      || reduce_strength (op, right))
+    {
+      emit_op (op, -1);
+      fold_constants (start);
+    }
+  *tpp = tp;
+  return 0;
+}
+
+/* Compile the expression for a statement.  If native code is enabled,
+ * the expression is preceded by an OP_HOT which counts how often it is
+ * evaluated, so only the expressions which are used often get compiled
+ * to native code. */
+static int
+compile_expression (unsigned short **tpp)
+{
+  size_t hot;
+
+  if (!jit_enabled)
+    return compile_number (tpp);
+
+  emit_op (OP_HOT, 0);
+  hot = code_used;
+  emit ()->index = JIT_THRESHOLD;
+  emit ();
+  if (compile_number (tpp))
+    return -1;
+  code_buffer[hot + 1].index = code_used - (hot + 2);
+  return 0;
+}
+
+/* Compile a statement.  Returns 0 if successful,
+ * -1 if the statement has to be interpreted. */
+static int
+compile_statement (struct statement_header *stmt)
+{
+  unsigned short *tp;
+  unsigned short var;
+
+  switch (stmt->command)
+    {
+    case LET:
+    case _LET_:
+      /* Only assignments to simple numeric variables */
+      tp = &stmt->tokens[0];
+      if ((tp[0] != NUMLVAL) || (tp[1] != IDENTIFIER))
+	return -1;
+      var = tp[2];
+      tp += 3;
+      if ((*tp++ != '=') || (*tp++ != NUMEXPR))
+	return -1;
+      if (compile_expression (&tp))
+	return -1;
+      if ((*tp != ':') && (*tp != '\n') && (*tp != ELSE))
+	return -1;
+      emit_op (OP_LET, -1);
+      emit ()->index = var;
+      return 0;
+
+    case IF:
+      tp = &((struct if_header *) stmt)->tokens[0];
+      if (compile_expression (&tp))
+	return -1;
+      if ((*tp != THEN) && (*tp != _THEN_))
+	return -1;
+      ++tp;
+      emit_op (OP_IF, -1);
+      emit ()->stmt = (struct statement_header *) tp;
+      return 0;
+    }
+
+  return -1;
+}
+
+/* Compile every statement on a line */
+void
+compile_line (struct program_line *pl)
+{
+  size_t *start;
+  size_t size;
+  int i;
+
+  free_line_code (pl);
+  pl->code_generation = function_generation;
+  start = (size_t *) malloc (sizeof (size_t) * (pl->num_statements + 1));
+  code_used = 0;
+  for (i = 0; i < pl->num_statements; i++)
+    {
+      start[i] = code_used;
+      stack_depth = max_stack_depth = 0;
+      if (compile_statement (pl->statement[i].stmt)
+	  || (max_stack_depth > VM_STACK_SIZE))
+	{
+	  /* Throw away whatever we compiled and interpret it instead */
+	  code_used = start[i];
+	  emit ()->op = OP_COMMAND;
+	  emit ()->stmt = pl->statement[i].stmt;
+	}
+    }
+
+  /* Copy the code for the line out of the buffer */
+  size = sizeof (union bytecode) * code_used;
+  pl->code = (union bytecode *) malloc (size ? size : 1);
+  memcpy (pl->code, code_buffer, size);
+  for (i = 0; i < pl->num_statements; i++)
+    pl->statement[i].code = &pl->code[start[i]];
+  free (start);
+}
+
+/* Compile a numeric expression by itself, for the C translator.
+ * Returns the number of words compiled, which are left in *code
+ * until the next compilation, or -1 if it can't be compiled. */
+long
+compile_numeric (unsigned short **tpp, union bytecode **code)
+{
+  code_used = 0;
+  stack_depth = max_stack_depth = 0;
+  if (compile_number (tpp))
+    return -1;
+  *code = code_buffer;
+  return code_used;
+}
+
+/* Discard the compiled code for a line */
+void
+free_line_code (struct program_line *pl)
+{
+  int i;
+
+  free (pl->code);
+  pl->code = NULL;
+  if (pl->statement != NULL)
+    for (i = 0; i < pl->num_statements; i++)
+      pl->statement[i].code = NULL;
+}
+
+/* Postfix code for each numeric expression in the program, so the
+ * interpreter doesn't have to walk the implied parentheses of the
+ * infix tokens every time.  The table is keyed by the address of the
+ * expression's opening '{' token, and uses open addressing with
+ * linear probing.  Entries are added when a line is entered, and
+ * removed when it is freed. */
+struct postfix {
+  unsigned short *tokens;	/* The '{' token, or NULL if unused */
+  unsigned short *end;		/* The token following the '}'	*/
+  unsigned long generation;	/* Function table generation
+				 * the code was compiled for	*/
+  union bytecode *code;		/* The expression, ending in OP_VALUE,
+				 * or NULL if it must be interpreted */
+};
+
+static struct postfix *postfix_table = NULL;
+static unsigned long postfix_size = 0;	/* 1 << postfix_bits	*/
+static int postfix_bits = 0;
+static unsigned long postfix_used = 0;
+
+/* Fibonacci hashing: the top bits of the product are well mixed */
+static inline unsigned long
+postfix_hash (unsigned short *tp)
+{
+  return ((((unsigned long) tp >> 1) * 0x9E3779B97F4A7C15UL)
+	  >> (8 * sizeof (unsigned long) - postfix_bits));
+}
+
+/* Find the slot for an expression, or the empty slot where it goes */
+static struct postfix *
+postfix_slot (unsigned short *tp)
+{
+  unsigned long i;
+
+  for (i = postfix_hash (tp); postfix_table[i].tokens != NULL;
+       i = (i + 1) & (postfix_size - 1))
+    if (postfix_table[i].tokens == tp)
+      break;
+  return &postfix_table[i];
+}
+
+/* Compile the postfix code for an expression.
+ * Returns 0 if successful, -1 if it has to be interpreted. */
+static int
+compile_entry (struct postfix *entry)
+{
+  unsigned short *tp = entry->tokens;
+
+  free (entry->code);
+  entry->code = NULL;
+  entry->generation = function_generation;
+  code_used = 0;
+  stack_depth = max_stack_depth = 0;
+  if (compile_number (&tp) || (max_stack_depth > VM_STACK_SIZE))
+    return -1;
+  entry->end = tp;
+  emit ()->op = OP_VALUE;
+  entry->code = (union bytecode *) malloc
+    (sizeof (union bytecode) * code_used);
+  memcpy (entry->code, code_buffer, sizeof (union bytecode) * code_used);
+  return 0;
+}
+
+/* Add an expression to the table */
+static void
+add_postfix (unsigned short *tp)
+{
+  struct postfix *old_table = postfix_table;
+  unsigned long old_size = postfix_size;
+  struct postfix *entry;
+  unsigned long i;
+
+  /* Keep the table no more than half full */
+  if (2 * (postfix_used + 1) > postfix_size)
+    {
+      postfix_bits = postfix_bits ? (postfix_bits + 1) : 8;
+      postfix_size = 1UL << postfix_bits;
+      postfix_table = (struct postfix *) calloc
+	(postfix_size, sizeof (struct postfix));
+      for (i = 0; i < old_size; i++)
+	if (old_table[i].tokens != NULL)
+	  *postfix_slot (old_table[i].tokens) = old_table[i];
+      free (old_table);
+    }
+
+  entry = postfix_slot (tp);
+  if (entry->tokens == NULL)
+    {
+      postfix_used++;
+      entry->tokens = tp;
+      entry->code = NULL;
+    }
+  compile_entry (entry);
+}
+
+/* Remove an expression from the table, moving any following
+ * entries in the same run back so they can still be found. */
+static void
+remove_postfix (unsigned short *tp)
+{
+  struct postfix *entry;
+  unsigned long i, j, home;
+
+  if (postfix_used == 0)
+    return;
+  entry = postfix_slot (tp);
+  if (entry->tokens == NULL)
+    return;
+  free (entry->code);
+  postfix_used--;
+  i = j = entry - postfix_table;
+  while (1)
+    {
+      j = (j + 1) & (postfix_size - 1);
+      if (postfix_table[j].tokens == NULL)
+	break;
+      home = postfix_hash (postfix_table[j].tokens);
+      /* Move the entry back if its home slot is not between
+       * the hole and where the entry is now (cyclically). */
+      if ((i <= j) ? ((home <= i) || (home > j))
+	  : ((home <= i) && (home > j)))
+	{
+	  postfix_table[i] = postfix_table[j];
+	  i = j;
+	}
+    }
+  postfix_table[i].tokens = NULL;
+  postfix_table[i].code = NULL;
+}
+
+/* Call a function for each numeric expression in a range of tokens,
+ * including the ones in lists and nested in other expressions. */
+static void
+walk_expressions (unsigned short *tp, unsigned short *end,
+		  void (*visit) (unsigned short *))
+{
+  struct list_header *lhp;
+  struct list_item *lip;
+  int i, separator;
+
+  while (tp < end)
+    {
+      switch ((int) *tp)
+	{
+	case '{':
+	  if (tp[1] != STREXPR)
+	    visit (tp);
+	  ++tp;
+	  break;
+
+	case INTEGER:
+	  tp = (unsigned short *) &((unsigned long *) &tp[1])[1];
+	  break;
+
+	case FLOATINGPOINT:
+	  tp = (unsigned short *) &((double *) &tp[1])[1];
+	  break;
+
+	case STRING:
+	case RESTOFLINE:
+	  ++tp;
+	  tp = (unsigned short *) &((char *) tp)
+	    [WALIGN (sizeof (struct string_value)
+		     + ((struct string_value *) tp)->length + 1)];
+	  break;
+
+	case IDENTIFIER:
+	case STRINGIDENTIFIER:
+	  tp += 2;
+	  break;
+
+	case ITEMLIST:
+	case PRINTLIST:
+	  /* Items in an ITEMLIST are followed by a separator
+	   * which is not included in the item length. */
+	  separator = (*tp++ == ITEMLIST) ? sizeof (short) : 0;
+	  lhp = (struct list_header *) tp;
+	  lip = &lhp->item[0];
+	  for (i = 0; i < lhp->num_items; i++)
+	    {
+	      walk_expressions (&lip->tokens[0], (unsigned short *)
+				&((char *) lip)[lip->length], visit);
+	      lip = (struct list_item *) &((char *) lip)
+		[lip->length + separator];
+	    }
+	  tp = (unsigned short *) &((char *) tp)[lhp->length];
+	  break;
+
+	default:
+	  ++tp;
+	  break;
+	}
+    }
+}
+
+/* Call a function for each numeric expression on a line */
+static void
+walk_line (struct line_header *line, void (*visit) (unsigned short *))
+{
+  struct statement_header *stmt;
+  unsigned short *tp;
+
+  for (stmt = &line->statement[0];
+       (char *) stmt < &((char *) line)[line->length];
+       stmt = (struct statement_header *) &((char *) stmt)[stmt->length])
+    {
+      /* Skip the offsets in the header of an IF statement */
+      tp = (stmt->command == IF)
+	? &((struct if_header *) stmt)->tokens[0] : &stmt->tokens[0];
+      walk_expressions (tp, (unsigned short *)
+			&((char *) stmt)[stmt->length], visit);
+    }
+}
+
+/* Compile the numeric expressions on a new line to postfix code */
+void
+compile_postfix (struct line_header *line)
+{
+  walk_line (line, add_postfix);
+}
+
+/* Discard the postfix code for a line which is about to be freed */
+void
+free_postfix (struct line_header *line)
+{
+  walk_line (line, remove_postfix);
+}
+
+/* For comparisons of equality, the interpreter uses a lower
+ * precision if the number will fit; we have to do the same. */
+static inline double
+reduce_precision (double value)
+{
+  if ((fabs (value) > FLT_MIN) && (fabs (value) < FLT_MAX))
+    {
+      volatile float reduce = value;
+      value = reduce;
+    }
+  return value;
+}
+
+/* Evaluate compiled expression code, stopping at the first
+ * statement operation (or OP_VALUE).  Returns a pointer to that
+ * operation; the value of the expression, if there is one, is
+ * left in *value. */
+static union bytecode *
+run_code (union bytecode *pc, double *value)
+{
+  double stack[VM_STACK_SIZE];
+  double *sp = stack;		/* Next free entry on the stack */
+  unsigned short *tp;
+  var_u args[32];
+  native_expr native;
+  int i, nargs;
+
+  while (1)
+    {
+      switch ((pc++)->op)
+	{
+	case OP_CONST:
+	  *sp++ = (pc++)->number;
+	  break;
+
+	case OP_LOAD:
+	  *sp++ = variable_values[(pc++)->index].num;
+	  break;
+
+	case OP_EVAL:
+	  tp = (pc++)->tokens;
+	  *sp++ = eval_number (&tp);
+	  break;
+
+	case OP_CALL:
+	  nargs = pc[1].index;
+	  sp -= nargs;
+	  for (i = 0; i < nargs; i++)
+	    args[i].num = sp[i];
+	  *sp++ = pc[0].built_in (args).num;
+	  pc += 2;
+	  break;
+
+	case OP_FN:
+	  *sp++ = eval_bound_function (pc[0].index, pc[1].tokens).num;
+	  pc += 2;
+	  break;
+
+	case OP_HOT:
+	  if (--pc[0].index == 0)
+	    {
+	      native = jit_expression (&pc[2], pc[1].index);
+	      if (native != NULL)
+		{
+		  pc[-1].op = OP_NATIVE;
+		  pc[0].native = native;
+		} else {
+		  pc[-1].op = OP_INTERP;
+		}
+	    }
+	  pc += 2;
+	  break;
+
+	case OP_NATIVE:
+	  *sp++ = pc[0].native ();
+	  pc += 2 + pc[1].index;
+	  break;
+
+	case OP_INTERP:
+	  pc += 2;
+	  break;
+
+	case OP_DUP:
+	  sp[0] = sp[-1];
+	  sp++;
+	  break;
+
+	case OP_ADD: --sp; sp[-1] += sp[0]; break;
+	case OP_SUB: --sp; sp[-1] -= sp[0]; break;
+	case OP_MUL: --sp; sp[-1] *= sp[0]; break;
+	case OP_DIV: --sp; sp[-1] /= sp[0]; break;
+	case OP_POW: --sp; sp[-1] = pow (sp[-1], sp[0]); break;
+
+	case OP_NEG: sp[-1] = -sp[-1]; break;
+	case OP_NOT: sp[-1] = (sp[-1] == 0.0); break;
+
+	case OP_EQ:
+	  --sp;
+	  sp[-1] = ((reduce_precision (sp[-1]) == reduce_precision (sp[0]))
+		    ? 1.0 : 0.0);
+	  break;
+	case OP_NE:
+	  --sp;
+	  sp[-1] = ((reduce_precision (sp[-1]) != reduce_precision (sp[0]))
+		    ? 1.0 : 0.0);
+	  break;
+	case OP_LT:
+	  --sp;
+	  sp[-1] = ((reduce_precision (sp[-1]) < reduce_precision (sp[0]))
+		    ? 1.0 : 0.0);
+	  break;
+	case OP_GT:
+	  --sp;
+	  sp[-1] = ((reduce_precision (sp[-1]) > reduce_precision (sp[0]))
+		    ? 1.0 : 0.0);
+	  break;
+	case OP_LE:
+	  --sp;
+	  sp[-1] = ((reduce_precision (sp[-1]) <= reduce_precision (sp[0]))
+		    ? 1.0 : 0.0);
+	  break;
+	case OP_GE:
+	  --sp;
+	  sp[-1] = ((reduce_precision (sp[-1]) >= reduce_precision (sp[0]))
+		    ? 1.0 : 0.0);
+	  break;
+	case OP_AND:
+	  --sp;
+	  sp[-1] = ((sp[-1] != 0.0) && (sp[0] != 0.0));
+	  break;
+	case OP_OR:
+	  --sp;
+	  sp[-1] = ((sp[-1] != 0.0) || (sp[0] != 0.0));
+	  break;
+
+	default:
+	  /* End of the expression */
+	  if (sp > stack)
+	    *value = sp[-1];
+	  return pc - 1;
+	}
+    }
+}
+
+/* Evaluate a numeric expression from its postfix code.  Returns 0
+ * and advances the token pointer past the expression if successful,
+ * or -1 if the expression has to be interpreted. */
+int
+eval_postfix (unsigned short **tpp, double *result)
+{
+  struct postfix *entry;
+
+  if (postfix_used == 0)
+    return -1;
+  entry = postfix_slot (*tpp);
+  if (entry->tokens == NULL)
+    return -1;
+  /* Recompile the expression if any functions have been (re)defined */
+  if ((entry->generation != function_generation)
+      && compile_entry (entry))
+    return -1;
+  if (entry->code == NULL)
+    return -1;
+  run_code (entry->code, result);
+  *tpp = entry->end;
+  return 0;
+}
+
+/* Execute the compiled code for a statement */
+void
+execute_compiled (struct program_line *pl, unsigned short index)
+{
+  union bytecode *pc;
+  double value = 0.0;
+
+  /* Recompile the line if any functions have been (re)defined */
+  if ((pl->code == NULL) || (pl->code_generation != function_generation))
+    compile_line (pl);
+  pc = run_code (pl->statement[index].code, &value);
+
+  switch (pc->op)
+    {
+    case OP_LET:
+      variable_values[pc[1].index].num = value;
+      return;
+
+    case OP_IF:
+      if_branch (pc[1].stmt, value);
+      return;
+
+    case OP_COMMAND:
+      execute_statement (pc[1].stmt);
+      return;
+
+    default:
+      fprintf (stderr, "execute_compiled(): Bad operation %d\n",
+	       (int) pc->op);
+      return;
+    }
+}
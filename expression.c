@@ -48,7 +48,7 @@ eval_number (unsigned short **tpp)
       ++tp;
       i = *tp++;
       /* If this is a simple variable, we can get its value directly */
-      if (*tp != '(')
+      if (!HAS_ARGUMENTS (tp))
 	{
 	  *tpp = tp;
 	  return variable_values[i].num;
@@ -87,6 +87,11 @@ eval_number (unsigned short **tpp)
       return result;
 
     case '{':	/* This is the start of an expression */
+      /* Use the postfix code if the expression has been compiled;
+       * tracing needs the interpreter to show each step. */
+      if (!(tracing & TRACE_EXPRESSIONS)
+	  && (eval_postfix (tpp, &result) == 0))
+	return result;
       ++tp;
       if (*tp == STREXPR)
 	{
@@ -121,39 +126,286 @@ eval_number (unsigned short **tpp)
 }
 
 
-/* Concatenate two strings.  Returns the new string.
- * The first string will have been reallocated; the second left alone. */
-static struct string_value *
-concat_strings (struct string_value *str1, const struct string_value *str2)
+/* The empty string, which unassigned string variables read as */
+static struct {
+  struct string_value string;
+  char contents[2];
+} empty_string = { { STATIC_STRING, 0 } };
+
+/* Every one-character string, so that CHR$, MID$(A$,I,1) and the like
+ * never need to allocate.  Filled in on first use. */
+static struct {
+  struct string_value string;
+  char contents[2];
+} single_chars[256];
+
+/* Temporary strings are carved out of a chain of scratch blocks,
+ * which is emptied after each statement by reset_scratch().  They are
+ * marked STATIC_STRING, so releasing one does nothing and keep_string()
+ * copies one to the heap when it is stored in a variable. */
+struct scratch_block {
+  struct scratch_block *next;
+  size_t size;			/* Bytes of data in the block */
+  size_t used;			/* Bytes handed out so far */
+  char data[0];
+};
+
+/* The usual size of a scratch block */
+#define SCRATCH_BLOCK_SIZE 4096
+
+static struct scratch_block *scratch_first = NULL;
+/* The block being allocated from, or NULL if nothing has been */
+static struct scratch_block *scratch_current = NULL;
+
+/* Allocate memory which lasts until the end of the statement */
+static void *
+scratch_alloc (size_t size)
+{
+  struct scratch_block *block = scratch_current, *new_block;
+  void *memory;
+
+  if ((block == NULL) && (scratch_first != NULL))
+    {
+      block = scratch_first;
+      block->used = 0;
+    }
+  while ((block == NULL) || (block->used + size > block->size))
+    {
+      if ((block != NULL) && (block->next != NULL))
+	{
+	  if (block->next->size >= size)
+	    {
+	      /* Reuse a block left over from an earlier statement */
+	      block = block->next;
+	      block->used = 0;
+	      continue;
+	    }
+	  /* It's too small to be any use; replace it */
+	  new_block = block->next;
+	  block->next = new_block->next;
+	  free (new_block);
+	  continue;
+	}
+      new_block = (struct scratch_block *) malloc
+	(sizeof (struct scratch_block)
+	 + ((size > SCRATCH_BLOCK_SIZE) ? size : SCRATCH_BLOCK_SIZE));
+      new_block->next = NULL;
+      new_block->size = (size > SCRATCH_BLOCK_SIZE)
+	? size : SCRATCH_BLOCK_SIZE;
+      new_block->used = 0;
+      if (block != NULL)
+	block->next = new_block;
+      else
+	scratch_first = new_block;
+      block = new_block;
+    }
+  scratch_current = block;
+  memory = &block->data[block->used];
+  block->used += size;
+  return memory;
+}
+
+/* Free everything allocated from the scratch blocks */
+void
+reset_scratch (void)
+{
+  scratch_current = NULL;
+}
+
+/* Remember how much of the scratch blocks is in use */
+void
+mark_scratch (struct scratch_mark *mark)
+{
+  mark->block = scratch_current;
+  mark->used = (scratch_current == NULL) ? 0 : scratch_current->used;
+}
+
+/* Free everything allocated from the scratch blocks since MARK */
+void
+release_scratch (const struct scratch_mark *mark)
 {
-  int len1, len2, newlen;
-
-  /* Do nothing if the second string is null. */
-  if (str2 == NULL)
-    return str1;
-
-  /* Make the first string large enough to contain the concatenation */
-  len1 = str1->length;
-  len2 = str2->length;
-  newlen = len1 + len2;
-  str1 = (struct string_value *) realloc
-    (str1, WALIGN (sizeof (struct string_value) + newlen + 1));
+  scratch_current = (struct scratch_block *) mark->block;
+  if (scratch_current != NULL)
+    scratch_current->used = mark->used;
+}
+
+/* Return a temporary string of the given length, to be filled in */
+struct string_value *
+scratch_string (int length)
+{
+  struct string_value *string;
+
+  string = (struct string_value *) scratch_alloc
+    (WALIGN (sizeof (struct string_value) + length + 1));
+  string->refs = STATIC_STRING;
+  string->length = length;
+  string->capacity = 0;
   /* Make sure the string gets terminated and padded */
-  *((short *) &str1->contents[WALIGN (newlen - 1)]) = 0;
-  /* Copy the second string onto the end of the first */
-  memcpy (&str1->contents[len1], str2->contents, len2);
-  str1->length = newlen;
-  return str1;
+  *((short *) &string->contents[WALIGN (length - 1)]) = 0;
+  return string;
+}
+
+/* Return a string with the given contents, which is a temporary
+ * string unless it is empty or a single character. */
+struct string_value *
+new_string (const char *contents, int length)
+{
+  struct string_value *string;
+  int i;
+
+  if (length == 0)
+    return &empty_string.string;
+  if (length == 1)
+    {
+      if (single_chars[0].string.refs != STATIC_STRING)
+	for (i = 0; i < 256; i++)
+	  {
+	    single_chars[i].string.refs = STATIC_STRING;
+	    single_chars[i].string.length = 1;
+	    single_chars[i].contents[0] = (char) i;
+	  }
+      return &single_chars[(unsigned char) contents[0]].string;
+    }
+  string = scratch_string (length);
+  memcpy (string->contents, contents, length);
+  return string;
 }
 
-/* Evaluate a string operand.  Return the result.
+/* Make a private copy of a string */
+static struct string_value *
+copy_string (const struct string_value *string)
+{
+  struct string_value *copy;
+
+  copy = (struct string_value *) malloc
+    (WALIGN (sizeof (struct string_value) + string->length + 1));
+  memcpy (copy, string,
+	  WALIGN (sizeof (struct string_value) + string->length + 1));
+  copy->refs = 0;
+  copy->capacity = 0;
+  return copy;
+}
+
+/* Add a reference to a string.  A string with too many
+ * references already gets copied instead. */
+struct string_value *
+share_string (struct string_value *string)
+{
+  if (string == NULL)
+    return &empty_string.string;
+  if (string->refs == STATIC_STRING)
+    return string;
+  if (string->refs == STATIC_STRING - 1)
+    return copy_string (string);
+  string->refs++;
+  return string;
+}
+
+/* Get a reference which can be stored in a variable; constants in
+ * the token stream go away when their line is changed, and temporary
+ * strings at the end of the statement. */
+struct string_value *
+keep_string (struct string_value *string)
+{
+  if ((string == NULL) || (string->refs != STATIC_STRING))
+    return string;
+  /* The empty and single-character strings last forever */
+  if (string->length <= 1)
+    return new_string (string->contents, string->length);
+  return copy_string (string);
+}
+
+/* Append a string to one stored in a variable, in place unless
+ * someone else can see it.  The room for it grows geometrically,
+ * so building up a string a piece at a time takes linear time
+ * rather than quadratic.  Returns the result, which may have moved;
+ * the reference to the original string is given up. */
+struct string_value *
+append_string (struct string_value *string, const struct string_value *tail)
+{
+  struct string_value *grown;
+  unsigned int length, capacity;
+
+  if (string == NULL)
+    string = &empty_string.string;
+  if (tail->length == 0)
+    return string;
+  length = string->length + tail->length;
+  if ((string->refs != 0) || (WALIGN (length + 1) > string->capacity))
+    {
+      capacity = 2 * WALIGN (length + 1);
+      if (string->refs == 0)
+	grown = (struct string_value *) realloc
+	  (string, sizeof (struct string_value) + capacity);
+      else
+	{
+	  grown = (struct string_value *) malloc
+	    (sizeof (struct string_value) + capacity);
+	  grown->refs = 0;
+	  grown->length = string->length;
+	  memcpy (grown->contents, string->contents, string->length);
+	  release_string (string);
+	}
+      grown->capacity = capacity;
+      string = grown;
+    }
+  memcpy (&string->contents[string->length], tail->contents, tail->length);
+  /* Terminate and pad the string */
+  memset (&string->contents[length], 0, WALIGN (length + 1) - length);
+  string->length = length;
+  return string;
+}
+
+/* Drop a reference to a string, freeing it if it was the last one */
+void
+release_string (struct string_value *string)
+{
+  if ((string == NULL) || (string->refs == STATIC_STRING))
+    return;
+  if (string->refs)
+    string->refs--;
+  else
+    free (string);
+}
+
+/* Concatenate a number of strings into a temporary string, which
+ * is built in one pass.  The strings are released.  A single string
+ * is returned as it is. */
+static struct string_value *
+join_strings (struct string_value **parts, int count)
+{
+  struct string_value *string;
+  int i, length = 0;
+
+  if (count == 1)
+    return parts[0];
+  for (i = 0; i < count; i++)
+    length += parts[i]->length;
+  string = scratch_string (length);
+  length = 0;
+  for (i = 0; i < count; i++)
+    {
+      memcpy (&string->contents[length], parts[i]->contents,
+	      parts[i]->length);
+      length += parts[i]->length;
+      release_string (parts[i]);
+    }
+  return string;
+}
+
+/* The most operands eval_string() collects before joining them */
+#define MAX_PARTS 16
+
+/* Evaluate a string operand.  Return the result, which is a reference
+ * to be released with release_string().  A single operand is shared
+ * rather than copied, and a concatenation is a temporary string.
  * The token pointer is advanced to the next token after the operand. */
 struct string_value *
 eval_string (unsigned short **tpp)
 {
-  struct string_value *string, *string2;
+  struct string_value *parts[MAX_PARTS], *operand;
   unsigned short *tp = *tpp;
-  int i;
+  int i, num_parts = 0;
 
   /* Ignore STREXPR prefixes, but bail out on any others */
   switch ((int) *tp)
@@ -171,18 +423,14 @@ eval_string (unsigned short **tpp)
       return NULL;
     }
 
-  /* Start with an empty string */
-  string = (struct string_value *) calloc
-    (1, WALIGN (sizeof (struct string_value) + 1));
-
   while (1)
     {
       switch ((int) *tp)
 	{
 	case STRING:
 	  ++tp;
-	  /* Append the string directly */
-	  string = concat_strings (string, (const struct string_value *) tp);
+	  /* Use the constant directly */
+	  operand = (struct string_value *) tp;
 	  tp = (unsigned short *) &((char *) tp)
 	    [WALIGN (sizeof (struct string_value)
 		     + ((struct string_value *) tp)->length + 1)];
@@ -192,9 +440,9 @@ eval_string (unsigned short **tpp)
 	  ++tp;
 	  i = *tp++;
 	  /* If this is a simple variable, we can get its value directly */
-	  if (*tp != '(')
+	  if (!HAS_ARGUMENTS (tp))
 	    {
-	      string = concat_strings (string, variable_values[i].str);
+	      operand = share_string (variable_values[i].str);
 	    } else {
 	      /* Otherwise, call the function or array lookup routine */
 	      if (*(++tp) != ITEMLIST)
@@ -203,16 +451,11 @@ eval_string (unsigned short **tpp)
 		  list_token (tp, stderr);
 		  fprintf (stderr, " after identifier %s(\n",
 			   name_table[i]->contents);
+		  operand = NULL;
 		  break;
 		}
 	      ++tp;
-	      string2 = eval_fn_or_array (i, (struct list_header *) tp).str;
-	      if (string2 != NULL)
-		{
-		  string = concat_strings
-		    (string, (const struct string_value *) string2);
-		  free (string2);
-		}
+	      operand = eval_fn_or_array (i, (struct list_header *) tp).str;
 	      /* Skip past the argument list and closing parenthesis */
 	      tp = (unsigned short *) &((char *) tp)
 		[((struct list_header *) tp)->length];
@@ -225,9 +468,18 @@ eval_string (unsigned short **tpp)
 	  list_token (tp, stderr);
 	  fputc ('\n', stderr);
 	  *tpp = &tp[1];
-	  return string;
+	  return (num_parts == 0)
+	    ? share_string (NULL) : join_strings (parts, num_parts);
 	}
 
+      /* Join what we have so far if there is no room for more */
+      if (num_parts == MAX_PARTS)
+	{
+	  parts[0] = join_strings (parts, num_parts);
+	  num_parts = 1;
+	}
+      parts[num_parts++] = (operand == NULL) ? share_string (NULL) : operand;
+
       /* Check for concatenation */
       if (*tp != '+')
 	break;
@@ -236,7 +488,7 @@ eval_string (unsigned short **tpp)
     }
 
   *tpp = tp;
-  return string;
+  return join_strings (parts, num_parts);
 }
 
 
@@ -379,9 +631,12 @@ double
 eval_strcond (unsigned short **tpp)
 {
   struct string_value *string1, *string2;
+  struct scratch_mark mark;
   unsigned short op;
   int result;
 
+  /* The operands aren't needed once they're compared */
+  mark_scratch (&mark);
   string1 = eval_string (tpp);
   op = *((*tpp)++);
   string2 = eval_string (tpp);
@@ -420,8 +675,9 @@ eval_strcond (unsigned short **tpp)
       break;
     }
   }
-  free (string1);
-  free (string2);
+  release_string (string1);
+  release_string (string2);
+  release_scratch (&mark);
 
   switch (op)
     {
@@ -448,6 +704,7 @@ cmd_let (struct statement_header *stmt)
   unsigned short *tp;
   double *numptr;
   struct string_value **strptr, *newstr;
+  long element = -1;
   int i;
 
   tp = (unsigned short *) &stmt->tokens[0];
@@ -534,8 +791,8 @@ cmd_let (struct statement_header *stmt)
 	      break;
 	    }
 	  ++tp;
-	  strptr = str_array_lookup (i, (struct list_header *) tp);
-	  if (strptr == NULL)
+	  element = str_array_lookup (i, (struct list_header *) tp);
+	  if (element < 0)
 	    return;
 	  /* Skip past the argument list and closing parenthesis */
 	  tp = (unsigned short *) &((char *) tp)
@@ -552,12 +809,35 @@ cmd_let (struct statement_header *stmt)
       /* Skip past the '=' and STREXPR tokens */
       tp += 2;
 
+      /* An array element gets a copy of the result */
+      if (element >= 0)
+	{
+	  newstr = eval_string (&tp);
+	  set_str_array (i, element, newstr);
+	  if (tracing & TRACE_EXPRESSIONS)
+	    fprintf (stderr, "=\"%s\"\n", newstr->contents);
+	  release_string (newstr);
+	  return;
+	}
+
+      /* A$=A$+... appends to the variable's string where it is */
+      if ((tp[0] == STRINGIDENTIFIER) && (tp[1] == i) && (tp[2] == '+'))
+	{
+	  tp += 3;
+	  newstr = eval_string (&tp);
+	  *strptr = append_string (*strptr, newstr);
+	  release_string (newstr);
+	  if (tracing & TRACE_EXPRESSIONS)
+	    fprintf (stderr, "=\"%s\"\n", (*strptr)->contents);
+	  return;
+	}
+
       /* Get the result of the next expression.  Note that we don't
        * discard the original string yet, since it may be needed
        * in the expression. */
-      newstr = eval_string (&tp);
-      /* Now we can free the original string, and save the new. */
-      free (*strptr);
+      newstr = keep_string (eval_string (&tp));
+      /* Now we can release the original string, and save the new. */
+      release_string (*strptr);
       *strptr = newstr;
       if (tracing & TRACE_EXPRESSIONS)
 	fprintf (stderr, "=\"%s\"\n", newstr->contents);
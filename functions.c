@@ -78,6 +78,7 @@ initialize_builtin_functions (void)
   int i;
 
   function_table_size = NUM_INITIALIZERS;
+  function_generation++;
   function_table = (struct fndef *) realloc
     (function_table, sizeof (struct fndef) * NUM_INITIALIZERS);
   for (i = 0; (size_t) i < NUM_INITIALIZERS; i++)
@@ -95,7 +96,9 @@ initialize_builtin_functions (void)
       function_table[i].built_in
 	= built_in_initializers[i].func;
       function_table[i].expr = NULL;
+      function_table[i].arg_ids = NULL;
       function_table[i].array_dimension = NULL;
+      function_table[i].array_stride = NULL;
       function_table[i].array_data = NULL;
     }
 }
@@ -120,16 +123,14 @@ var_u fn_atn (var_u *args)
 
 var_u fn_chr (var_u *args)
 {
-  struct string_value *str = (struct string_value *) malloc (4);
-  str->length = 1;
+  char c;
+
   if ((args[0].num >= -4294967295.0) && (args[0].num <= 4294967295.0))
     {
-      str->contents[0] = (char) args[0].num;
-      str->contents[1] = '\0';
-    } else {
-      *((long *) str) = 0;
+      c = (char) args[0].num;
+      return (var_u) new_string (&c, 1);
     }
-  return (var_u) str;
+  return (var_u) new_string ("", 0);
 }
 
 var_u fn_cos (var_u *args)
@@ -160,7 +161,6 @@ var_u fn_int (var_u *args)
 var_u fn_left (var_u *args)
 {
   int len, len2;
-  struct string_value *new_str;
 
   if (args[1].num < 0.0)
     len = 0;
@@ -170,16 +170,9 @@ var_u fn_left (var_u *args)
     len = (int) args[1].num;
 
   len2 = (args[0].str == NULL) ? 0 : args[0].str->length;
-  if (len2 < len)
-    len = len2;
-  new_str = (struct string_value *) calloc
-    (1, WALIGN (sizeof (struct string_value) + len + 1));
-  if (len)
-    {
-      new_str->length = len;
-      memcpy (new_str->contents, args[0].str->contents, len);
-    }
-  return (var_u) new_str;
+  if (len2 <= len)
+    return (var_u) share_string (args[0].str);
+  return (var_u) new_string (args[0].str->contents, len);
 }
 
 var_u fn_len (var_u *args)
@@ -198,15 +191,19 @@ var_u fn_log (var_u *args)
 var_u fn_lower (var_u *args)
 {
   int i, len;
+  char c;
   struct string_value *new_str;
 
   if (args[0].str == NULL)
     return args[0];
 
   len = args[0].str->length;
-  new_str = (struct string_value *) calloc
-    (1, WALIGN (sizeof (struct string_value) + len));
-  new_str->length = len;
+  if (len <= 1)
+    {
+      c = tolower (len ? args[0].str->contents[0] : 0);
+      return (var_u) new_string (&c, len);
+    }
+  new_str = scratch_string (len);
   for (i = 0; i < len; i++)
     new_str->contents[i] = tolower(args[0].str->contents[i]);
 
@@ -216,7 +213,6 @@ var_u fn_lower (var_u *args)
 var_u fn_mid (var_u *args)
 {
   int start, len, len2;
-  struct string_value *new_str;
 
   /* This is the one function where the base index matters.
    * Most BASICs say MID$(X$,1,1) is the 1st character of X$. */
@@ -239,14 +235,9 @@ var_u fn_mid (var_u *args)
     start = len2;
   if (start + len > len2)
     len = len2 - start;
-  new_str = (struct string_value *) calloc
-    (1, WALIGN (sizeof (struct string_value) + len + 1));
-  if (len)
-    {
-      new_str->length = len;
-      memcpy (new_str->contents, &args[0].str->contents[start], len);
-    }
-  return (var_u) new_str;
+  if (len == len2)
+    return (var_u) share_string (args[0].str);
+  return (var_u) new_string (&args[0].str->contents[start], len);
 }
 
 var_u fn_radtodeg (var_u *args)
@@ -284,7 +275,6 @@ var_u fn_seed (var_u *args)
 var_u fn_right (var_u *args)
 {
   int len, len2;
-  struct string_value *new_str;
 
   if (args[1].num < 0.0)
     len = 0;
@@ -294,16 +284,9 @@ var_u fn_right (var_u *args)
     len = (int) args[1].num;
 
   len2 = (args[0].str == NULL) ? 0 : args[0].str->length;
-  if (len2 < len)
-    len = len2;
-  new_str = (struct string_value *) calloc
-    (1, WALIGN (sizeof (struct string_value) + len + 1));
-  if (len)
-    {
-      new_str->length = len;
-      memcpy (new_str->contents, &args[0].str->contents[len2 - len], len);
-    }
-  return (var_u) new_str;
+  if (len2 <= len)
+    return (var_u) share_string (args[0].str);
+  return (var_u) new_string (&args[0].str->contents[len2 - len], len);
 }
 
 var_u fn_sgn (var_u *args)
@@ -336,18 +319,12 @@ var_u fn_sqr (var_u *args)
 
 var_u fn_str (var_u *args)
 {
-  int oldlen = 30;
-  struct string_value *str = (struct string_value *) calloc
-    (1, sizeof (struct string_value) + oldlen);
-  while (1) {
-    str->length = snprintf (str->contents, oldlen, "%G", args[0].num);
-    str = (struct string_value *) realloc
-      (str, WALIGN (sizeof (struct string_value) + str->length + 1));
-    if (str->length < oldlen)
-      return (var_u) str;
-    oldlen = WALIGN (str->length + 1);
-    memset (str, 0, sizeof (struct string_value) + oldlen);
-  }
+  /* %G never needs more than a sign, 6 digits, a point
+   * and a 4-digit exponent, nor more for inf or nan. */
+  char buf[32];
+
+  return (var_u) new_string
+    (buf, snprintf (buf, sizeof (buf), "%G", args[0].num));
 }
 
 var_u fn_tan (var_u *args)
@@ -360,15 +337,19 @@ var_u fn_tan (var_u *args)
 var_u fn_upper (var_u *args)
 {
   int i, len;
+  char c;
   struct string_value *new_str;
 
   if (args[0].str == NULL)
     return args[0];
 
   len = args[0].str->length;
-  new_str = (struct string_value *) calloc
-    (1, WALIGN (sizeof (struct string_value) + len));
-  new_str->length = len;
+  if (len <= 1)
+    {
+      c = toupper (len ? args[0].str->contents[0] : 0);
+      return (var_u) new_string (&c, len);
+    }
+  new_str = scratch_string (len);
   for (i = 0; i < len; i++)
     new_str->contents[i] = toupper(args[0].str->contents[i]);
 
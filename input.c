@@ -18,51 +18,62 @@ static int suppress_prompt = 0;
 static struct string_value *
 sgets (void)
 {
-  struct string_value *new_string;
+  struct string_value *line;
   int current_size, next_read;
 
   /* Allocate the string's initial size */
   current_size = 80;
-  new_string = (struct string_value *) malloc
+  line = (struct string_value *) malloc
     (sizeof (struct string_value) + current_size);
-  new_string->length = 0;
+  line->refs = 0;
+  line->length = 0;
+  line->capacity = 0;
   next_read = 0;
   while (1)
     {
       /* Read in the next string segment */
-      fgets (&new_string->contents[next_read],
+      fgets (&line->contents[next_read],
 	     current_size - next_read, stdin);
       /* If we were interrupted, don't return anything */
       if (feof (stdin) || (ferror (stdin) && (errno == EINTR)))
 	{
-	  free (new_string);
+	  free (line);
 	  clearerr (stdin);
 	  executing = 0;
 	  return NULL;
 	}
-      next_read += strlen (&new_string->contents[next_read]);
-      new_string->length = next_read;
+      next_read += strlen (&line->contents[next_read]);
+      line->length = next_read;
 
       /* We can stop when we reach a newline */
-      if (new_string->contents[next_read - 1] == '\n') {
+      if (line->contents[next_read - 1] == '\n') {
 	current_column = 0;
 	break;
       }
       /* Otherwise, extend the string and read again. */
       current_size += 80;
-      new_string = (struct string_value *) realloc
-	(new_string, sizeof (struct string_value) + current_size);
+      line = (struct string_value *) realloc
+	(line, sizeof (struct string_value) + current_size);
     }
 
   /* Remove the trailing newline */
-  new_string->contents[new_string->length = next_read - 1] = '\0';
+  line->contents[line->length = next_read - 1] = '\0';
+
+  /* Short replies (Y, N, a menu choice) come from the string table */
+  if (line->length <= 1)
+    {
+      struct string_value *short_line
+	= new_string (line->contents, line->length);
+      free (line);
+      return short_line;
+    }
 
   /* The string is probably much larger than we really need,
    * so shrink it before returning. */
   current_size = WALIGN (next_read);
-  new_string = (struct string_value *) realloc
-    (new_string, sizeof (struct string_value) + current_size);
-  return new_string;
+  line = (struct string_value *) realloc
+    (line, sizeof (struct string_value) + current_size);
+  return line;
 }
 
 /* Read a number from standard input. */
@@ -142,6 +153,7 @@ cmd_input (struct statement_header *stmt)
   unsigned short *tp;
   double *numptr;
   struct string_value **strptr, *newstr;
+  long element;
   struct list_header *list;
   struct list_item *item;
   int i, var, type;
@@ -193,6 +205,7 @@ cmd_input (struct statement_header *stmt)
 	}
 
       /* Assume a simple variable */
+      element = -1;
       if (type == IDENTIFIER)
 	numptr = &variable_values[var].num;
       else
@@ -228,8 +241,8 @@ cmd_input (struct statement_header *stmt)
 	      	      if (numptr == NULL)
 		return;
 	    } else {
-	      strptr = str_array_lookup (var, (struct list_header *) tp);
-	      if (strptr == NULL)
+	      element = str_array_lookup (var, (struct list_header *) tp);
+	      if (element < 0)
 		return;
 	    }
 	  /* Skip past the argument list and closing parenthesis */
@@ -257,10 +270,16 @@ cmd_input (struct statement_header *stmt)
 	  newstr = sgets ();
 	  if (newstr == NULL)
 	    return;
-	  free (*strptr);
-	  *strptr = newstr;
 	  if (tracing & TRACE_EXPRESSIONS)
 	    fprintf (stderr, "=\"%s\"\n", newstr->contents);
+	  if (element >= 0)
+	    {
+	      set_str_array (var, element, newstr);
+	      release_string (newstr);
+	    } else {
+	      release_string (*strptr);
+	      *strptr = newstr;
+	    }
 	}
 
       /* Skip to the next variable in the variable list. */
@@ -269,106 +288,147 @@ cmd_input (struct statement_header *stmt)
     }
 }
 
-/* Find the next line containing data to read. */
-static int
-find_data (struct statement_header **stmtp)
+/* The DATA pool: every item of every DATA statement in the program,
+ * in order, decoded the first time READ or RESTORE needs it after the
+ * program has changed.  Since the items are in order of line number,
+ * the pool also serves as the index for RESTORE. */
+static struct data_item {
+  struct string_value *str;	/* The string constant in the DATA
+				 * statement, or NULL for a number */
+  double num;
+  unsigned long line_number;	/* Where the item comes from	*/
+  unsigned short statement;
+  unsigned short item;
+} *data_pool;
+static unsigned long data_pool_size, data_pool_allocated;
+/* The program generation the pool was decoded for */
+static unsigned long data_generation = (unsigned long) -1;
+/* The next item to READ; data_pool_size if there is no more data */
+static unsigned long data_position;
+
+/* Find the first data item at or after the given item of a statement */
+static unsigned long
+find_data (unsigned long line_number, unsigned short statement,
+	   unsigned short item)
 {
-  unsigned short *tp;
-  struct line_header *line;
-  struct statement_header *stmt;
+  unsigned long low = 0, high = data_pool_size, mid;
+  struct data_item *datum;
 
-  while (1)
+  while (low < high)
     {
-      /* Does the current data line exist? */
-      line = find_line (current_data_line, 1);
-      if (line == NULL)
-	{
-	  /* No more data. */
-	  current_data_line = (unsigned long) -1;
-	  return -1;
-	}
-      if (line->line_number != current_data_line)
-	{
-	  /* Line not found; go on to the next line. */
-	  current_data_line = line->line_number;
-	  current_data_statement = 0;
-	  current_data_item = 0;
-	}
+      mid = low + (high - low) / 2;
+      datum = &data_pool[mid];
+      if ((datum->line_number < line_number)
+	  || ((datum->line_number == line_number)
+	      && ((datum->statement < statement)
+		  || ((datum->statement == statement)
+		      && (datum->item < item)))))
+	low = mid + 1;
+      else
+	high = mid;
+    }
+  return low;
+}
 
-      /* Does the current data statement exist? */
-      stmt = find_statement (line, current_data_statement);
-      if (stmt == NULL)
-	{
-	  /* No more statements on this line; go to the next line. */
-	  current_data_line++;
-	  current_data_statement = 0;
-	  current_data_item = 0;
-	  continue;
-	}
-      /* Is the current statement `DATA'? */
-      while (stmt->command != DATA)
+/* Decode the DATA statements of the program into the pool, if the
+ * program has changed since it was last done.  READ continues from
+ * the same place in the program it would have before. */
+static void
+update_data_pool (void)
+{
+  unsigned short *tp;
+  struct program_line *pl;
+  struct statement_header *stmt, *end;
+  struct list_header *data_list;
+  struct list_item *data_item;
+  struct data_item *datum, next;
+  unsigned short statement;
+  int i, saved_tracing;
+
+  if (data_generation == program_generation)
+    return;
+
+  /* Remember where the next item came from (its line has not been
+   * freed yet, but its strings may have been) */
+  if (data_position < data_pool_size)
+    next = data_pool[data_position];
+  else if (data_pool_size > 0)
+    {
+      next = data_pool[data_pool_size - 1];
+      next.item++;
+    }
+  else
+    {
+      next.line_number = 0;
+      next.statement = next.item = 0;
+    }
+
+  /* Numbers are decoded quietly; they are only constants */
+  saved_tracing = tracing;
+  tracing &= ~TRACE_EXPRESSIONS;
+  data_pool_size = 0;
+  for (pl = find_program_line (0, 1); pl != NULL; pl = pl->next[0])
+    {
+      stmt = &pl->line->statement[0];
+      end = (struct statement_header *)
+	&((char *) pl->line)[pl->line->length];
+      for (statement = 0; stmt < end; statement++,
+	     stmt = (struct statement_header *) &((char *) stmt)[stmt->length])
 	{
-	  /* Wrong statement; go to the next one */
-	  current_data_statement++;
-	  current_data_item = 0;
-	  stmt = (struct statement_header *) &((char *) stmt)[stmt->length];
-	  if ((char *) stmt >= &((char *) line)[line->length])
+	  if (stmt->command != DATA)
+	    continue;
+	  tp = &stmt->tokens[0];
+	  if (*tp++ != ITEMLIST)
 	    {
-	      /* No `DATA' statements on this line. */
-	      stmt = NULL;
-	      break;
+	      fputs ("update_data_pool: Unexpected token ", stderr);
+	      list_token (--tp, stderr);
+	      fprintf (stderr, " following DATA statement on line %lu\n",
+		       pl->line->line_number);
+	      continue;
 	    }
-	}
-      if (stmt == NULL)
-	{
-	  /* No `DATA' statements on this line; go to the next line. */
-	  current_data_line++;
-	  current_data_statement = 0;
-	  continue;
-	}
-
-      /* Are there any more data items on this statement? */
-      tp = (unsigned short *) &stmt[1];
-      if (*tp++ != ITEMLIST)
-	{
-	  fputs ("find_data: Unexpected token ", stderr);
-	  list_token (--tp, stderr);
-	  fprintf (stderr, " following DATA statement on line %d\n",
-		   line->line_number);
-	  current_data_statement++;
-	  current_data_item = 0;
-	  continue;
-	}
-      if (current_data_item >= ((struct list_header *) tp)->num_items)
-	{
-	  /* Ran out of data; go to the next `DATA' statement. */
-	  current_data_item = 0;
-	  do
+	  data_list = (struct list_header *) tp;
+	  data_item = &data_list->item[0];
+	  for (i = 0; i < data_list->num_items; i++)
 	    {
-	      current_data_statement++;
-	      stmt = (struct statement_header *)
-		&((char *) stmt)[stmt->length];
-	      if ((char *) stmt >= &((char *) line)[line->length])
+	      if (data_pool_size >= data_pool_allocated)
 		{
-		  /* No more `DATA' statements on this line. */
-		  stmt = NULL;
-		  break;
+		  data_pool_allocated = data_pool_allocated
+		    ? (data_pool_allocated * 2) : 64;
+		  data_pool = (struct data_item *) realloc
+		    (data_pool, sizeof (struct data_item) * data_pool_allocated);
 		}
-	    } while (stmt->command != DATA);
-	  if (stmt == NULL)
-	    {
-	      /* No more `DATA' statements on this line; */
-	      /* go to the next line. */
-	      current_data_line++;
-	      current_data_statement = 0;
-	      continue;
+	      datum = &data_pool[data_pool_size++];
+	      datum->line_number = pl->line->line_number;
+	      datum->statement = statement;
+	      datum->item = i;
+	      tp = &data_item->tokens[0];
+	      if (*tp == STRING)
+		{
+		  datum->str = (struct string_value *) &tp[1];
+		  datum->num = 0.0;
+		} else {
+		  datum->str = NULL;
+		  datum->num = eval_number (&tp);
+		}
+	      /* Skip the item and the ',' token */
+	      data_item = (struct list_item *)
+		&((char *) data_item)[data_item->length + sizeof (short)];
 	    }
 	}
-
-      /* At this point, we have some data.  Return the statement. */
-      *stmtp = stmt;
-      return 0;
     }
+  tracing = saved_tracing;
+  data_generation = program_generation;
+
+  data_position = find_data (next.line_number, next.statement, next.item);
+}
+
+/* Start reading data from the first DATA statement
+ * on or after the given line. */
+void
+restore_data (unsigned long line_number)
+{
+  update_data_pool ();
+  data_position = find_data (line_number, 0, 0);
 }
 
 void
@@ -384,29 +444,13 @@ void
 cmd_read (struct statement_header *stmt)
 {
   unsigned short *tp;
-  struct statement_header *data_stmt;
-  struct list_header *data_list;
-  struct list_item *data_item;
+  struct data_item *datum;
   struct list_header *read_list;
   struct list_item *read_item;
   int var_index, type, i;
   double *numptr;
   struct string_value **strptr, *newstr;
-
-  /* Find the statement containing the next data to read */
-  if (find_data (&data_stmt) < 0)
-    {
-      puts ("ERROR - READ: NO MORE DATA");
-      executing = 0;
-      return;
-    }
-  /* The data list structure follows the ITEMLIST token. */
-  data_list = (struct list_header *) &data_stmt->tokens[1];
-  /* Skip ahead to the `current_data_item'th element in the data list. */
-  data_item = &data_list->item[0];
-  for (var_index = 0; var_index < current_data_item; var_index++)
-    data_item = (struct list_item *)
-      &((char *) data_item)[data_item->length + sizeof (short)];
+  long element;
 
   tp = &stmt->tokens[0];
   if (*tp++ != ITEMLIST)
@@ -417,10 +461,20 @@ cmd_read (struct statement_header *stmt)
       return;
     }
   read_list = (struct list_header *) tp;
+  update_data_pool ();
 
   read_item = &read_list->item[0];
   for (var_index = 0; var_index < read_list->num_items; var_index++)
     {
+      /* Make sure there is some data left to read */
+      if (data_position >= data_pool_size)
+	{
+	  puts ("ERROR - READ: NO MORE DATA");
+	  executing = 0;
+	  return;
+	}
+      datum = &data_pool[data_position];
+
       /* Get the next variable to read into. */
       tp = &read_item->tokens[0];
       type = *tp++;
@@ -436,6 +490,7 @@ cmd_read (struct statement_header *stmt)
       // additional evaluations along the way.
       if (tracing & TRACE_EXPRESSIONS)
 	fprintf (stderr, "%s", name_table[i]->contents);
+      element = -1;
       if (type == IDENTIFIER)
 	numptr = &variable_values[i].num;
       else
@@ -465,8 +520,8 @@ cmd_read (struct statement_header *stmt)
 	      if (numptr == NULL)
 		return;
 	    } else {
-	      strptr = str_array_lookup (i, (struct list_header *) tp);
-	      if (strptr == NULL)
+	      element = str_array_lookup (i, (struct list_header *) tp);
+	      if (element < 0)
 		return;
 	    }
 	  if (tracing & TRACE_EXPRESSIONS)
@@ -478,8 +533,7 @@ cmd_read (struct statement_header *stmt)
 	}
 
       /* Check that the next data type matches the variable type */
-      tp = &data_item->tokens[0];
-      if ((type == STRINGIDENTIFIER) != (*tp == STRING))
+      if ((type == STRINGIDENTIFIER) != (datum->str != NULL))
 	{
 	  puts ("ERROR - READ: WRONG DATA TYPE");
 	  executing = 0;
@@ -488,46 +542,24 @@ cmd_read (struct statement_header *stmt)
       /* Assign the value */
       if (type == IDENTIFIER)
 	{
-	  *numptr = eval_number (&tp);
+	  *numptr = datum->num;
 	  if (tracing & TRACE_EXPRESSIONS)
 	    fprintf (stderr, "=%g\n", *numptr);
 	} else {
-	  newstr = eval_string (&tp);
-	  if (newstr == NULL)
-	    return;
-	  free (*strptr);
-	  *strptr = newstr;
 	  if (tracing & TRACE_EXPRESSIONS)
-	    fprintf (stderr, "=\"%s\"\n", newstr->contents);
+	    fprintf (stderr, "=\"%s\"\n", datum->str->contents);
+	  if (element >= 0)
+	    set_str_array (i, element, datum->str);
+	  else {
+	    newstr = keep_string (datum->str);
+	    release_string (*strptr);
+	    *strptr = newstr;
+	  }
 	}
+      data_position++;
 
-      /* Advance to the next `READ' variable and `DATA' item.
-       * Skip the `,` token in both cases. */
+      /* Advance to the next `READ' variable, skipping the `,' token. */
       read_item = (struct list_item *)
 	&((char *) read_item)[read_item->length + sizeof (short)];
-      data_item = (struct list_item *)
-	&((char *) data_item)[data_item->length + sizeof (short)];
-      current_data_item++;
-
-      /* Skip actually looking up the next item
-       * if we're not going to read any more. */
-      if (var_index + 1 >= read_list->num_items)
-	break;
-      if (current_data_item >= data_list->num_items)
-	{
-	  /* Find the next `DATA' statement. */
-	  current_data_item = 0;
-	  current_data_statement++;
-	  if (find_data (&data_stmt) < 0)
-	    {
-	      puts ("ERROR - READ: NO MORE DATA");
-	      executing = 0;
-	      return;
-	    }
-
-	  /* Reset the data list and data item pointers */
-	  data_list = (struct list_header *) &data_stmt->tokens[1];
-	  data_item = &data_list->item[0];
-	}
     }
 }
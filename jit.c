@@ -0,0 +1,448 @@
+/* Native code generation for the bytecode engine
+ *
+ * When an expression in a compiled statement has been evaluated often
+ * enough, bytecode.c asks us to translate it to x86-64 machine code.
+ * The expression stack is kept in the SSE registers: the value at
+ * depth N lives in %xmmN, so we can handle expressions up to
+ * MAX_REGISTERS deep; %xmm14 and %xmm15 are used as scratch registers.
+ * Since all SSE registers are clobbered by function calls, any values
+ * still on the stack are saved in the frame around each call.
+ *
+ * The generated function takes no arguments and returns the value of
+ * the expression in %xmm0.  %rbx holds the address of the variable
+ * table while it runs.  Operations which don't have a simple machine
+ * equivalent call back into C: built-in functions, pow(), comparisons
+ * (which have to reduce their precision the same way the interpreter
+ * does), OP_EVAL, and OP_FN.
+ *
+ * Native code is kept in one mmap'd area which is written while it is
+ * not executable, and is reset whenever all of the program's compiled
+ * code is discarded. */
+
+#include <float.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "tables.h"
+
+/* Compile hot expressions to native code (-j) */
+int jit_enabled = 0;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+#include <sys/mman.h>
+
+/* Size of the area used for native code */
+#define JIT_AREA_SIZE (1 << 20)
+/* Room to leave for the longest sequence generated for one operation:
+ * saving and restoring every register around a call, plus the call. */
+#define MAX_OP_SIZE 512
+/* Number of SSE registers used for the expression stack */
+#define MAX_REGISTERS 14
+#define SCRATCH1 14
+#define SCRATCH2 15
+/* Stack frame: room for the arguments of a built-in function,
+ * followed by room to save the expression registers */
+#define ARGS_OFFSET 0
+#define SAVE_OFFSET (32 * 8)
+#define FRAME_SIZE (SAVE_OFFSET + MAX_REGISTERS * 8)
+
+/* General registers, by their number in the instruction encoding */
+#define RAX 0
+#define RSP 4
+#define RBX 3
+#define RSI 6
+#define RDI 7
+
+static unsigned char *jit_area = NULL;
+static size_t jit_used = 0;
+/* Where the next instruction byte goes */
+static unsigned char *jp;
+
+
+/* Emit a byte of machine code */
+static inline void
+byte (int b)
+{
+  *jp++ = (unsigned char) b;
+}
+
+/* Emit a 32-bit value */
+static void
+imm32 (unsigned int value)
+{
+  memcpy (jp, &value, 4);
+  jp += 4;
+}
+
+/* Emit a 64-bit value */
+static void
+imm64 (unsigned long value)
+{
+  memcpy (jp, &value, 8);
+  jp += 8;
+}
+
+/* Emit a REX prefix if one is needed.  `reg' goes in the ModR/M reg
+ * field, and `rm' in the r/m field; `w' selects 64-bit operands. */
+static void
+rex (int w, int reg, int rm)
+{
+  int prefix = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+  if (prefix != 0x40)
+    byte (prefix);
+}
+
+/* movabs $value, %reg */
+static void
+load_immediate (int reg, unsigned long value)
+{
+  rex (1, 0, reg);
+  byte (0xB8 + (reg & 7));
+  imm64 (value);
+}
+
+/* Call a C function; the arguments must already be in place */
+static void
+call (void *function)
+{
+  load_immediate (RAX, (unsigned long) function);
+  byte (0xFF);		/* call *%rax */
+  byte (0xD0);
+}
+
+/* An SSE instruction between two registers, with the given
+ * mandatory prefix (0x66 or 0xF2) and opcode (after 0x0F) */
+static void
+sse (int prefix, int opcode, int dst, int src)
+{
+  byte (prefix);
+  rex (0, dst, src);
+  byte (0x0F);
+  byte (opcode);
+  byte (0xC0 | ((dst & 7) << 3) | (src & 7));
+}
+
+/* movsd between a register and memory at `disp'(%base).
+ * `opcode' is 0x10 for a load or 0x11 for a store. */
+static void
+movsd_memory (int opcode, int xmm, int base, unsigned int disp)
+{
+  byte (0xF2);
+  rex (0, xmm, base);
+  byte (0x0F);
+  byte (opcode);
+  byte (0x80 | ((xmm & 7) << 3) | (base & 7));
+  if ((base & 7) == RSP)
+    byte (0x24);	/* SIB: no index */
+  imm32 (disp);
+}
+
+/* movq %rax, %xmm */
+static void
+move_rax_to_xmm (int xmm)
+{
+  byte (0x66);
+  rex (1, xmm, RAX);
+  byte (0x0F);
+  byte (0x6E);
+  byte (0xC0 | ((xmm & 7) << 3));
+}
+
+/* Load a constant into an SSE register */
+static void
+load_constant (int xmm, double value)
+{
+  unsigned long bits;
+
+  memcpy (&bits, &value, sizeof (bits));
+  load_immediate (RAX, bits);
+  move_rax_to_xmm (xmm);
+}
+
+/* Save or restore registers 0 through n-1 around a call */
+static void
+save_registers (int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    movsd_memory (0x11, i, RSP, SAVE_OFFSET + 8 * i);
+}
+
+static void
+restore_registers (int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    movsd_memory (0x10, i, RSP, SAVE_OFFSET + 8 * i);
+}
+
+
+/* Functions called from native code */
+
+static double
+jit_eval (unsigned short *tp)
+{
+  return eval_number (&tp);
+}
+
+static double
+jit_function (unsigned long slot, unsigned short *tp)
+{
+  return eval_bound_function (slot, tp).num;
+}
+
+static double
+jit_call (var_u (*built_in) (var_u *), var_u *args)
+{
+  return built_in (args).num;
+}
+
+/* Comparisons and logical operations, as eval_numexpr() does them */
+static inline double
+reduce_precision (double value)
+{
+  if ((fabs (value) > FLT_MIN) && (fabs (value) < FLT_MAX))
+    {
+      volatile float reduce = value;
+      value = reduce;
+    }
+  return value;
+}
+
+static double
+jit_compare (double op1, double op2, int op)
+{
+  if (op == OP_AND)
+    return ((op1 != 0.0) && (op2 != 0.0));
+  if (op == OP_OR)
+    return ((op1 != 0.0) || (op2 != 0.0));
+  op1 = reduce_precision (op1);
+  op2 = reduce_precision (op2);
+  switch (op)
+    {
+    case OP_EQ: return ((op1 == op2) ? 1.0 : 0.0);
+    case OP_NE: return ((op1 != op2) ? 1.0 : 0.0);
+    case OP_LT: return ((op1 < op2) ? 1.0 : 0.0);
+    case OP_GT: return ((op1 > op2) ? 1.0 : 0.0);
+    case OP_LE: return ((op1 <= op2) ? 1.0 : 0.0);
+    case OP_GE: return ((op1 >= op2) ? 1.0 : 0.0);
+    }
+  return 0.0;
+}
+
+
+/* Generate a call to a function of two doubles (plus an optional
+ * integer) whose operands are the top two values on the stack of
+ * `depth' entries, replacing them with the result. */
+static void
+binary_call (void *function, int depth, int op)
+{
+  int a = depth - 2, b = depth - 1;
+
+  save_registers (a);
+  if (a != 0)
+    sse (0x66, 0x28, 0, a);	/* movapd %xmmA, %xmm0 */
+  if (b != 1)
+    sse (0x66, 0x28, 1, b);	/* movapd %xmmB, %xmm1 */
+  load_immediate (RDI, (unsigned long) op);
+  call (function);
+  if (a != 0)
+    sse (0x66, 0x28, a, 0);	/* movapd %xmm0, %xmmA */
+  restore_registers (a);
+}
+
+/* Compile bytecode for an expression to native code.
+ * Returns NULL if we can't. */
+native_expr
+jit_expression (union bytecode *code, unsigned long length)
+{
+  union bytecode *pc, *end = &code[length];
+  unsigned char *start;
+  int depth = 0, nargs, i;
+
+  if (jit_area == NULL)
+    {
+      jit_area = (unsigned char *) mmap
+	(NULL, JIT_AREA_SIZE, PROT_READ | PROT_WRITE,
+	 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (jit_area == (unsigned char *) MAP_FAILED)
+	{
+	  perror ("jit_expression: mmap");
+	  jit_area = NULL;
+	  jit_enabled = 0;
+	  return NULL;
+	}
+    }
+  else if (mprotect (jit_area, JIT_AREA_SIZE, PROT_READ | PROT_WRITE))
+    return NULL;
+
+  start = jp = &jit_area[jit_used];
+
+  /* Prologue: save %rbx, make room for the frame (keeping the stack
+   * aligned to 16 bytes), and point %rbx at the variable table. */
+  byte (0x53);				/* push %rbx */
+  byte (0x48); byte (0x81); byte (0xEC);	/* sub $FRAME_SIZE, %rsp */
+  imm32 (FRAME_SIZE);
+  load_immediate (RAX, (unsigned long) &variable_values);
+  byte (0x48); byte (0x8B); byte (0x18);	/* mov (%rax), %rbx */
+
+  for (pc = code; pc < end; )
+    {
+      if ((jit_used + (jp - start) + MAX_OP_SIZE > JIT_AREA_SIZE)
+	  || (depth >= MAX_REGISTERS))
+	goto fail;
+
+      switch ((pc++)->op)
+	{
+	case OP_CONST:
+	  load_constant (depth++, (pc++)->number);
+	  break;
+
+	case OP_LOAD:
+	  movsd_memory (0x10, depth++, RBX, sizeof (var_u) * (pc++)->index);
+	  break;
+
+	case OP_EVAL:
+	  save_registers (depth);
+	  load_immediate (RDI, (unsigned long) (pc++)->tokens);
+	  call (jit_eval);
+	  if (depth != 0)
+	    sse (0x66, 0x28, depth, 0);	/* movapd %xmm0, %xmmN */
+	  restore_registers (depth);
+	  depth++;
+	  break;
+
+	case OP_FN:
+	  save_registers (depth);
+	  load_immediate (RDI, pc[0].index);
+	  load_immediate (RSI, (unsigned long) pc[1].tokens);
+	  call (jit_function);
+	  if (depth != 0)
+	    sse (0x66, 0x28, depth, 0);	/* movapd %xmm0, %xmmN */
+	  restore_registers (depth);
+	  depth++;
+	  pc += 2;
+	  break;
+
+	case OP_CALL:
+	  nargs = pc[1].index;
+	  if (nargs > 32)
+	    goto fail;
+	  depth -= nargs;
+	  /* Store the arguments, then save the rest of the stack */
+	  for (i = 0; i < nargs; i++)
+	    movsd_memory (0x11, depth + i, RSP, ARGS_OFFSET + 8 * i);
+	  save_registers (depth);
+	  load_immediate (RDI, (unsigned long) pc[0].built_in);
+	  byte (0x48); byte (0x8D); byte (0x74);	/* lea ARGS(%rsp), %rsi */
+	  byte (0x24); byte (ARGS_OFFSET);
+	  call (jit_call);
+	  if (depth != 0)
+	    sse (0x66, 0x28, depth, 0);	/* movapd %xmm0, %xmmN */
+	  restore_registers (depth);
+	  depth++;
+	  pc += 2;
+	  break;
+
+	case OP_DUP:
+	  sse (0x66, 0x28, depth, depth - 1);	/* movapd */
+	  depth++;
+	  break;
+
+	case OP_ADD:
+	  depth--;
+	  sse (0xF2, 0x58, depth - 1, depth);	/* addsd */
+	  break;
+	case OP_SUB:
+	  depth--;
+	  sse (0xF2, 0x5C, depth - 1, depth);	/* subsd */
+	  break;
+	case OP_MUL:
+	  depth--;
+	  sse (0xF2, 0x59, depth - 1, depth);	/* mulsd */
+	  break;
+	case OP_DIV:
+	  depth--;
+	  sse (0xF2, 0x5E, depth - 1, depth);	/* divsd */
+	  break;
+
+	case OP_POW:
+	  binary_call (pow, depth, 0);
+	  depth--;
+	  break;
+
+	case OP_NEG:
+	  /* Flip the sign bit */
+	  load_immediate (RAX, 0x8000000000000000UL);
+	  move_rax_to_xmm (SCRATCH1);
+	  sse (0x66, 0x57, depth - 1, SCRATCH1);	/* xorpd */
+	  break;
+
+	case OP_NOT:
+	  /* Compare with 0.0 for a mask, then mask 1.0 with it */
+	  sse (0x66, 0x57, SCRATCH1, SCRATCH1);	/* xorpd */
+	  sse (0xF2, 0xC2, depth - 1, SCRATCH1);	/* cmpeqsd */
+	  byte (0);
+	  load_constant (SCRATCH2, 1.0);
+	  sse (0x66, 0x54, depth - 1, SCRATCH2);	/* andpd */
+	  break;
+
+	case OP_EQ: case OP_NE: case OP_LT: case OP_GT:
+	case OP_LE: case OP_GE: case OP_AND: case OP_OR:
+	  binary_call (jit_compare, depth, pc[-1].op);
+	  depth--;
+	  break;
+
+	default:
+	  /* Anything else isn't part of an expression */
+	  goto fail;
+	}
+    }
+  if (depth != 1)
+    goto fail;
+
+  /* Epilogue: the result is already in %xmm0 */
+  byte (0x48); byte (0x81); byte (0xC4);	/* add $FRAME_SIZE, %rsp */
+  imm32 (FRAME_SIZE);
+  byte (0x5B);				/* pop %rbx */
+  byte (0xC3);				/* ret */
+
+  jit_used += jp - start;
+  /* Keep each function aligned to 16 bytes */
+  jit_used = (jit_used + 15) & ~15UL;
+  mprotect (jit_area, JIT_AREA_SIZE, PROT_READ | PROT_EXEC);
+  return (native_expr) start;
+
+ fail:
+  mprotect (jit_area, JIT_AREA_SIZE, PROT_READ | PROT_EXEC);
+  return NULL;
+}
+
+/* Discard all native code.  The caller must make
+ * sure nothing refers to it any more. */
+void
+jit_reset (void)
+{
+  jit_used = 0;
+}
+
+#else /* ! x86-64 */
+
+/* There's no code generator for this machine;
+ * the bytecode engine does all the work. */
+native_expr
+jit_expression (union bytecode *code, unsigned long length)
+{
+  return NULL;
+}
+
+void
+jit_reset (void)
+{
+}
+
+#endif /* ! x86-64 */
@@ -17,7 +17,21 @@
 
 /* The program. */
 int program_size = 0;		/* Number of lines in the program */
-struct line_header **program = NULL;
+/* Incremented every time a line is added or removed,
+ * which invalidates any links between statements and lines. */
+unsigned long program_generation = 0;
+
+/* Head of the program index.  Its forward pointers lead to the
+ * first line of the program at each level of the skip list. */
+static struct program_line *line_index = NULL;
+/* Number of levels currently in use by the index */
+static int line_index_levels = 1;
+/* The line most recently found, since most lookups are
+ * either for the same line or for the one following it. */
+static struct program_line *last_hit = NULL;
+/* State for choosing the level of a new index entry.  We don't use
+ * rand(), since that would disturb the sequence seen by RND. */
+static unsigned long level_seed = 1;
 
 
 /* Constant data */
@@ -36,6 +50,8 @@ const struct {
   { EXPRESSIONS, "EXPRESSIONS " },
   { END, "END" },
   { ERROR, "ERROR" },
+  { FAST, " FAST" },
+  { ARRAYFILE, " FILE " },
   { FOR, "FOR " },
   { GOSUB, "GOSUB " },
   { GOTO, "GOTO " },
@@ -48,14 +64,17 @@ const struct {
   { LINES, "LINES " },
   { LIST, "LIST " },
   { LOAD, "LOAD " },
+  { MAT, "MAT " },
   { NEW, "NEW" },
   { NEXT, "NEXT " },
   { OFF, "OFF" },
   { ON, "ON " },
   { PAUSE, "PAUSE " },
   { PARSER, "PARSER " },
+  { PRESERVE, "PRESERVE " },
   { PRINT, "PRINT " },
   { READ, "READ " },
+  { REDIM, "REDIM " },
   { REM, "REM " },
   { RESTORE, "RESTORE " },
   { RETURN, "RETURN" },
@@ -78,16 +97,97 @@ const struct {
   { OR, " OR " },
   /* Non-keyword tokens */
   { TAB, "TAB" },
+  /* Matrix functions and constants */
+  { CON, "CON" },
+  { IDN, "IDN" },
+  { INV, "INV" },
+  { TRN, "TRN" },
+  { ZER, "ZER" },
 };
 
 
+/* Allocate the head of the program index if we haven't already */
+static void
+init_line_index (void)
+{
+  if (line_index != NULL)
+    return;
+  line_index = (struct program_line *) calloc
+    (1, sizeof (struct program_line)
+     + LINE_INDEX_LEVELS * sizeof (struct program_line *));
+  line_index->levels = LINE_INDEX_LEVELS;
+}
+
+/* Pick a random number of levels for a new index entry,
+ * with each additional level being 1/4 as likely as the last. */
+static int
+random_levels (void)
+{
+  int levels = 1;
+
+  /* xorshift; any reasonable generator will do */
+  level_seed ^= level_seed << 13;
+  level_seed ^= level_seed >> 7;
+  level_seed ^= level_seed << 17;
+  while ((levels < LINE_INDEX_LEVELS) && !(level_seed & (3UL << (2 * levels))))
+    levels++;
+  return levels;
+}
+
+/* Search the index for the last entry at each level whose line number
+ * is less than the given number.  Returns the entry that follows it,
+ * which is the first line at or after `number', or NULL if none. */
+static struct program_line *
+search_index (unsigned long number, struct program_line **update)
+{
+  struct program_line *pl = line_index;
+  int level;
+
+  for (level = line_index_levels - 1; level >= 0; level--)
+    {
+      while ((pl->next[level] != NULL)
+	     && (pl->next[level]->line->line_number < number))
+	pl = pl->next[level];
+      if (update != NULL)
+	update[level] = pl;
+    }
+  return pl->next[0];
+}
+
+/* Same as find_line, but returns the program index entry for the line. */
+struct program_line *
+find_program_line (unsigned long number, int after)
+{
+  struct program_line *pl;
+
+  init_line_index ();
+
+  /* Check the last line found and the one following it first */
+  pl = last_hit;
+  if ((pl != NULL) && (pl->line->line_number < number))
+    {
+      pl = pl->next[0];
+      if ((pl != NULL) && (pl->line->line_number < number))
+	pl = search_index (number, NULL);
+    }
+  else if ((pl == NULL) || (pl->line->line_number != number))
+    pl = search_index (number, NULL);
+
+  if (pl == NULL)
+    return NULL;
+  if (!after && (pl->line->line_number != number))
+    return NULL;
+  last_hit = pl;
+  return pl;
+}
+
 /* This function returns the line with the given number.
  * If the flag is true and the given line does not exist,
  * the next existing line is returned. */
 struct line_header *
 find_line (unsigned long number, int after)
 {
-  int i;
+  struct program_line *pl;
 
   if ((signed long) number == -1) {
     /* The reference is to the immediate (unnumbered) line. */
@@ -95,16 +195,8 @@ find_line (unsigned long number, int after)
     return immediate_line;
   }
 
-  for (i = 0; i < program_size; i++)
-    {
-      if (program[i]->line_number >= number)
-	{
-	  if (!after && (program[i]->line_number > number))
-	    return NULL;
-	  return program[i];
-	}
-    }
-  return NULL;
+  pl = find_program_line (number, after);
+  return (pl == NULL) ? NULL : pl->line;
 }
 
 /* This function adds a new line to the program.
@@ -112,58 +204,103 @@ find_line (unsigned long number, int after)
 void
 add_line (struct line_header *line)
 {
-  int i;
+  struct program_line *update[LINE_INDEX_LEVELS];
+  struct program_line *pl;
+  int i, levels;
+
+  init_line_index ();
+  program_generation++;
+  pl = search_index (line->line_number, update);
+  if ((pl != NULL) && (pl->line->line_number == line->line_number))
+    {
+      /* This line already exists; replace it. */
+      free (pl->code);
+      pl->code = NULL;
+      free (pl->statement);
+      pl->statement = NULL;
+      pl->num_statements = 0;
+      free_postfix (pl->line);
+      free (pl->line);
+      pl->line = line;
+      compile_postfix (line);
+      return;
+    }
 
-  for (i = 0; i < program_size; i++)
+  /* Link a new entry into the index at each of its levels */
+  levels = random_levels ();
+  for (i = line_index_levels; i < levels; i++)
+    update[i] = line_index;
+  if (levels > line_index_levels)
+    line_index_levels = levels;
+  pl = (struct program_line *) malloc
+    (sizeof (struct program_line) + levels * sizeof (struct program_line *));
+  pl->line = line;
+  pl->num_statements = 0;
+  pl->statement = NULL;
+  pl->code = NULL;
+  pl->levels = levels;
+  compile_postfix (line);
+  for (i = 0; i < levels; i++)
     {
-      if (program[i]->line_number < line->line_number)
-	continue;
-      if (program[i]->line_number == line->line_number)
-	{
-	  /* This line already exists; replace it. */
-	  free (program[i]);
-	  program[i] = line;
-	  return;
-	}
-      else /* (program[i]->line_number > line->line_number) */
-	{
-	  /* Add another line to the program array */
-	  program = (struct line_header **) realloc
-	    (program, sizeof (struct line_header *) * ++program_size);
-	  /* Insert the new line at `i'. */
-	  memmove (&program[i + 1], &program[i],
-		   sizeof (struct line_header *) * (program_size - (i + 1)));
-	  program[i] = line;
-	  return;
-	}
+      pl->next[i] = update[i]->next[i];
+      update[i]->next[i] = pl;
     }
-  /* This line goes at the end of the program. */
-  program = (struct line_header **) realloc
-	    (program, sizeof (struct line_header *) * (++program_size));
-  program[i] = line;
-  return;
+  program_size++;
 }
 
 /* Remove a line from the program. */
 void
 remove_line (unsigned long number)
 {
+  struct program_line *update[LINE_INDEX_LEVELS];
+  struct program_line *pl;
+  int i;
+
+  init_line_index ();
+  pl = search_index (number, update);
+  if ((pl == NULL) || (pl->line->line_number != number))
+    /* Line not found */
+    return;
+
+  program_generation++;
+  for (i = 0; i < pl->levels; i++)
+    update[i]->next[i] = pl->next[i];
+  while ((line_index_levels > 1)
+	 && (line_index->next[line_index_levels - 1] == NULL))
+    line_index_levels--;
+  if (last_hit == pl)
+    last_hit = NULL;
+  free (pl->code);
+  free (pl->statement);
+  free_postfix (pl->line);
+  free (pl->line);
+  free (pl);
+  program_size--;
+}
+
+/* Remove all lines from the program. */
+void
+clear_program (void)
+{
+  struct program_line *pl, *next;
   int i;
 
-  for (i = 0; i < program_size; i++)
+  init_line_index ();
+  for (pl = line_index->next[0]; pl != NULL; pl = next)
     {
-      if (program[i]->line_number < number)
-	continue;
-      if (program[i]->line_number == number)
-	{
-	  free (program[i]);
-	  memmove (&program[i], &program[i + 1],
-		   sizeof (struct line_header *) * (--program_size - i));
-	  return;
-	}
-      else /* Line not found */
-	return;
+      next = pl->next[0];
+      free (pl->code);
+      free (pl->statement);
+      free_postfix (pl->line);
+      free (pl->line);
+      free (pl);
     }
+  for (i = 0; i < LINE_INDEX_LEVELS; i++)
+    line_index->next[i] = NULL;
+  line_index_levels = 1;
+  last_hit = NULL;
+  program_size = 0;
+  program_generation++;
 }
 
 int
@@ -197,12 +334,14 @@ list_token (unsigned short *tp, FILE *to)
     {
     case RESTOFLINE:
       fputs (((struct string_value *) &tp[1])->contents, to);
-      return (2 + (WALIGN (((struct string_value *) &tp[1])->length + 1)
+      return (1 + (WALIGN (sizeof (struct string_value)
+			   + ((struct string_value *) &tp[1])->length + 1)
 		   / sizeof (short)));
 
     case STRING:
       fprintf (to, "\"%s\"", ((struct string_value *) &tp[1])->contents);
-      return (2 + (WALIGN (((struct string_value *) &tp[1])->length + 1)
+      return (1 + (WALIGN (sizeof (struct string_value)
+			   + ((struct string_value *) &tp[1])->length + 1)
 		   / sizeof (short)));
 
     case INTEGER:
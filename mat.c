@@ -0,0 +1,563 @@
+/* Matrix statements (MAT)
+ *
+ * As in Dartmouth BASIC, a numeric array DIMmed as A(N,M) is used as
+ * an N by M matrix whose elements are A(1,1) through A(N,M); row and
+ * column 0 are left alone.  A one-dimensional array A(N) is a vector
+ * of the elements A(1) through A(N), which is used as a column, except
+ * on the left of a product, where it is used as a row.
+ *
+ * Each statement works directly on the arrays' storage, following the
+ * distance between rows given by the array's stride, so an array which
+ * has room to grow (see REDIM PRESERVE) or is kept in a file works the
+ * same as any other.  The result is worked out in a separate block of
+ * memory and then copied into the array on the left, which is (re)DIMmed
+ * if it doesn't already have the right dimensions; so the same array
+ * may appear on both sides.
+ *
+ * All of the arithmetic is done a row at a time by two kernels: one
+ * which adds a multiple of one row to another, and one which scales a
+ * row.  On x86-64 processors with AVX2, these work on four elements at
+ * once.  The additions for each element are done in the same order
+ * either way (and multiplies and adds are never fused), so the results
+ * don't depend on which is used.  Products are worked out in blocks
+ * small enough to stay in the cache. */
+
+#include <limits.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tables.h"
+#include "basic.tab.h"
+
+/* The rows and columns of each block of a product: BLOCK_ROWS rows
+ * of the left matrix by BLOCK_ROWS rows of the right one, and
+ * BLOCK_COLUMNS columns of the right one and the result */
+#define BLOCK_ROWS 64
+#define BLOCK_COLUMNS 256
+
+/* A matrix, as found in an array (or in a block of memory).
+ * Element (i,j), counting from 0, is at base[i * stride + j]. */
+struct matrix {
+  double *base;
+  unsigned long rows, columns;
+  unsigned long stride;		/* Distance between rows	*/
+  int vector;			/* Set if it's a one-dimensional array */
+};
+
+
+/* Row kernels */
+
+/* row[j] += k * other[j], for j = 0 ... n-1 */
+static void
+add_row_scalar (double *row, const double *other, double k, unsigned long n)
+{
+  unsigned long j;
+
+  for (j = 0; j < n; j++)
+    row[j] += k * other[j];
+}
+
+/* row[j] = k * other[j], for j = 0 ... n-1 (row may be other) */
+static void
+scale_row_scalar (double *row, const double *other, double k,
+		  unsigned long n)
+{
+  unsigned long j;
+
+  for (j = 0; j < n; j++)
+    row[j] = k * other[j];
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+#include <immintrin.h>
+
+__attribute__ ((target ("avx2")))
+static void
+add_row_avx2 (double *row, const double *other, double k, unsigned long n)
+{
+  __m256d factor = _mm256_set1_pd (k);
+  unsigned long j;
+
+  for (j = 0; j + 4 <= n; j += 4)
+    _mm256_storeu_pd (&row[j], _mm256_add_pd
+		      (_mm256_loadu_pd (&row[j]),
+		       _mm256_mul_pd (factor, _mm256_loadu_pd (&other[j]))));
+  for (; j < n; j++)
+    row[j] += k * other[j];
+}
+
+__attribute__ ((target ("avx2")))
+static void
+scale_row_avx2 (double *row, const double *other, double k, unsigned long n)
+{
+  __m256d factor = _mm256_set1_pd (k);
+  unsigned long j;
+
+  for (j = 0; j + 4 <= n; j += 4)
+    _mm256_storeu_pd (&row[j], _mm256_mul_pd
+		      (factor, _mm256_loadu_pd (&other[j])));
+  for (; j < n; j++)
+    row[j] = k * other[j];
+}
+
+#endif /* x86-64 */
+
+/* The kernels to use, chosen the first time they're needed */
+static void (*add_row) (double *, const double *, double, unsigned long);
+static void (*scale_row) (double *, const double *, double, unsigned long);
+
+static void
+choose_kernels (void)
+{
+  add_row = add_row_scalar;
+  scale_row = scale_row_scalar;
+#if defined(__x86_64__) && defined(__GNUC__)
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    {
+      add_row = add_row_avx2;
+      scale_row = scale_row_avx2;
+    }
+#endif
+}
+
+
+/* Matrix operations.  The result always goes into a new
+ * block of memory, of `rows' rows of `columns' elements. */
+
+/* Allocate a zeroed matrix for a result */
+static int
+new_matrix (struct matrix *m, unsigned long rows, unsigned long columns,
+	    int vector)
+{
+  m->rows = rows;
+  m->columns = columns;
+  m->stride = columns;
+  m->vector = vector;
+  m->base = NULL;
+  if ((columns == 0) || (rows <= ULONG_MAX / columns))
+    m->base = (double *) calloc ((rows && columns) ? rows * columns : 1,
+				 sizeof (double));
+  if (m->base == NULL)
+    {
+      puts ("ERROR - MAT: OUT OF MEMORY");
+      executing = 0;
+      return -1;
+    }
+  return 0;
+}
+
+/* c = a * b, blocked so the rows of b being used stay in the cache.
+ * Each element of c is still the sum of its products in order. */
+static void
+multiply (struct matrix *c, const struct matrix *a, const struct matrix *b)
+{
+  unsigned long i0, k0, j0, i, k, i_end, k_end, j_end;
+
+  for (i0 = 0; i0 < a->rows; i0 += BLOCK_ROWS)
+    {
+      i_end = (i0 + BLOCK_ROWS < a->rows) ? i0 + BLOCK_ROWS : a->rows;
+      for (k0 = 0; k0 < a->columns; k0 += BLOCK_ROWS)
+	{
+	  k_end = (k0 + BLOCK_ROWS < a->columns)
+	    ? k0 + BLOCK_ROWS : a->columns;
+	  for (j0 = 0; j0 < b->columns; j0 += BLOCK_COLUMNS)
+	    {
+	      j_end = (j0 + BLOCK_COLUMNS < b->columns)
+		? j0 + BLOCK_COLUMNS : b->columns;
+	      for (i = i0; i < i_end; i++)
+		for (k = k0; k < k_end; k++)
+		  add_row (&c->base[i * c->stride + j0],
+			   &b->base[k * b->stride + j0],
+			   a->base[i * a->stride + k], j_end - j0);
+	    }
+	}
+    }
+}
+
+/* c = a + k * b (k is 1 or -1), or c = k * a if b is NULL */
+static void
+combine (struct matrix *c, const struct matrix *a,
+	 const struct matrix *b, double k)
+{
+  unsigned long i;
+
+  for (i = 0; i < a->rows; i++)
+    if (b == NULL)
+      scale_row (&c->base[i * c->stride], &a->base[i * a->stride],
+		 k, a->columns);
+    else
+      {
+	memcpy (&c->base[i * c->stride], &a->base[i * a->stride],
+		a->columns * sizeof (double));
+	add_row (&c->base[i * c->stride], &b->base[i * b->stride],
+		 k, a->columns);
+      }
+}
+
+/* c = the transpose of a, a block at a time */
+static void
+transpose (struct matrix *c, const struct matrix *a)
+{
+  unsigned long i0, j0, i, j, i_end, j_end;
+
+  for (i0 = 0; i0 < a->rows; i0 += BLOCK_ROWS)
+    {
+      i_end = (i0 + BLOCK_ROWS < a->rows) ? i0 + BLOCK_ROWS : a->rows;
+      for (j0 = 0; j0 < a->columns; j0 += BLOCK_ROWS)
+	{
+	  j_end = (j0 + BLOCK_ROWS < a->columns)
+	    ? j0 + BLOCK_ROWS : a->columns;
+	  for (i = i0; i < i_end; i++)
+	    for (j = j0; j < j_end; j++)
+	      c->base[j * c->stride + i] = a->base[i * a->stride + j];
+	}
+    }
+}
+
+/* c = the inverse of a, by Gauss-Jordan elimination with partial
+ * pivoting.  Stores the determinant of a, which is 0 if a is singular
+ * (and c is left unfinished).  Returns 0, or -1 if out of memory. */
+static int
+invert (struct matrix *c, const struct matrix *a, double *determinant)
+{
+  unsigned long n = a->rows, i, p, pivot;
+  double *work, *row, k;
+
+  work = (double *) malloc ((n ? n * n : 1) * sizeof (double));
+  row = (double *) malloc ((n ? n : 1) * sizeof (double));
+  if ((work == NULL) || (row == NULL))
+    {
+      free (work);
+      free (row);
+      puts ("ERROR - MAT: OUT OF MEMORY");
+      executing = 0;
+      return -1;
+    }
+  *determinant = 1.0;
+  for (i = 0; i < n; i++)
+    {
+      memcpy (&work[i * n], &a->base[i * a->stride], n * sizeof (double));
+      c->base[i * c->stride + i] = 1.0;
+    }
+
+  for (p = 0; p < n; p++)
+    {
+      /* Use the largest remaining element in this column */
+      pivot = p;
+      for (i = p + 1; i < n; i++)
+	if (fabs (work[i * n + p]) > fabs (work[pivot * n + p]))
+	  pivot = i;
+      if (work[pivot * n + p] == 0.0)
+	{
+	  *determinant = 0.0;
+	  break;
+	}
+      if (pivot != p)
+	{
+	  memcpy (row, &work[p * n], n * sizeof (double));
+	  memcpy (&work[p * n], &work[pivot * n], n * sizeof (double));
+	  memcpy (&work[pivot * n], row, n * sizeof (double));
+	  memcpy (row, &c->base[p * c->stride], n * sizeof (double));
+	  memcpy (&c->base[p * c->stride], &c->base[pivot * c->stride],
+		  n * sizeof (double));
+	  memcpy (&c->base[pivot * c->stride], row, n * sizeof (double));
+	  *determinant = -*determinant;
+	}
+      *determinant *= work[p * n + p];
+
+      /* Scale the pivot row so the pivot is 1, then
+       * clear the rest of the column from the other rows */
+      k = 1.0 / work[p * n + p];
+      scale_row (&work[p * n + p], &work[p * n + p], k, n - p);
+      scale_row (&c->base[p * c->stride], &c->base[p * c->stride], k, n);
+      for (i = 0; i < n; i++)
+	{
+	  if ((i == p) || (work[i * n + p] == 0.0))
+	    continue;
+	  k = -work[i * n + p];
+	  add_row (&work[i * n + p], &work[p * n + p], k, n - p);
+	  add_row (&c->base[i * c->stride], &c->base[p * c->stride], k, n);
+	}
+    }
+
+  free (work);
+  free (row);
+  return 0;
+}
+
+
+/* Arrays */
+
+/* Find the matrix in a numeric array.  When `row' is set, a vector
+ * is taken as a single row instead of a single column.
+ * Returns 0 if successful, or -1 if there is no such array. */
+static int
+find_matrix (unsigned short id, struct matrix *m, int row)
+{
+  struct fndef *array = find_function (id);
+
+  if ((array == NULL) || (array->array_dimension == NULL)
+      || (array->type == '$') || (array->num_args > 2))
+    {
+      printf ("ERROR - MAT: %s IS NOT A NUMERIC ARRAY"
+	      " OF ONE OR TWO DIMENSIONS\n", name_table[id]->contents);
+      executing = 0;
+      return -1;
+    }
+  if (array->num_args == 1)
+    {
+      /* A(1) ... A(N) */
+      m->base = &((double *) array->array_data)[1];
+      m->rows = row ? 1 : array->array_dimension[0];
+      m->columns = row ? array->array_dimension[0] : 1;
+      m->stride = m->columns;
+      m->vector = 1;
+    } else {
+      /* A(1,1) ... A(N,M) */
+      m->stride = array->array_stride[0];
+      m->base = &((double *) array->array_data)[m->stride + 1];
+      m->rows = array->array_dimension[0];
+      m->columns = array->array_dimension[1];
+      m->vector = 0;
+    }
+  return 0;
+}
+
+/* Store a result in an array, which is (re)DIMmed unless it is
+ * already the right shape.  Frees the result's memory. */
+static void
+store_matrix (unsigned short id, struct matrix *result)
+{
+  struct fndef *array = find_function (id);
+  struct matrix m;
+  unsigned long dimension[2], i;
+
+  /* A vector result stays a vector */
+  if (result->vector)
+    {
+      dimension[0] = result->rows * result->columns;
+      if ((array == NULL) || (array->array_dimension == NULL)
+	  || array->type || (array->num_args != 1)
+	  || (array->array_dimension[0] != dimension[0]))
+	array = dim_array (id, 1, dimension);
+    } else {
+      dimension[0] = result->rows;
+      dimension[1] = result->columns;
+      if ((array == NULL) || (array->array_dimension == NULL)
+	  || array->type || (array->num_args != 2)
+	  || (array->array_dimension[0] != dimension[0])
+	  || (array->array_dimension[1] != dimension[1]))
+	array = dim_array (id, 2, dimension);
+    }
+  if ((array != NULL) && (find_matrix (id, &m, 0) == 0))
+    {
+      if (result->vector)
+	memcpy (m.base, result->base, dimension[0] * sizeof (double));
+      else
+	for (i = 0; i < result->rows; i++)
+	  memcpy (&m.base[i * m.stride], &result->base[i * result->stride],
+		  result->columns * sizeof (double));
+    }
+  free (result->base);
+}
+
+/* MAT A = ZER, CON or IDN, optionally with new dimensions */
+static void
+mat_constant (unsigned short id, int constant, unsigned short *tp)
+{
+  struct matrix m;
+  unsigned long dimension[2], i, j;
+
+  if (*tp == '(')
+    {
+      struct list_header *size_list = (struct list_header *) &tp[2];
+      if (size_list->num_items > 2)
+	{
+	  puts ("ERROR - MAT: TOO MANY DIMENSIONS");
+	  executing = 0;
+	  return;
+	}
+      if (get_indices (size_list, dimension, size_list->num_items, DIM)
+	  || (dim_array (id, size_list->num_items, dimension) == NULL))
+	return;
+    }
+  if (find_matrix (id, &m, 0))
+    return;
+  if ((constant == IDN) && (m.vector || (m.rows != m.columns)))
+    {
+      printf ("ERROR - MAT: %s IS NOT A SQUARE MATRIX\n",
+	      name_table[id]->contents);
+      executing = 0;
+      return;
+    }
+  for (i = 0; i < m.rows; i++)
+    for (j = 0; j < m.columns; j++)
+      m.base[i * m.stride + j] = (constant == CON) ? 1.0
+	: ((constant == IDN) && (i == j)) ? 1.0 : 0.0;
+}
+
+/* Report two arrays whose dimensions don't fit the operation */
+static void
+mismatch (unsigned short a, unsigned short b)
+{
+  printf ("ERROR - MAT: THE DIMENSIONS OF %s AND %s DO NOT MATCH\n",
+	  name_table[a]->contents, name_table[b]->contents);
+  executing = 0;
+}
+
+/*
+ * MAT statements have one of these forms:
+ * MAT: IDENTIFIER, c, '=', IDENTIFIER, a, [ ('+' | '-' | '*'),
+ *	IDENTIFIER, b, ]
+ * MAT: IDENTIFIER, c, '=', (TRN | INV), '(', IDENTIFIER, a, ')'
+ * MAT: IDENTIFIER, c, '=', '(', NUMEXPR, ..., ')', '*', IDENTIFIER, a
+ * MAT: IDENTIFIER, c, '=', (ZER | CON | IDN), [ '(', ITEMLIST, ..., ')' ]
+ */
+void
+cmd_mat (struct statement_header *stmt)
+{
+  unsigned short *tp = &stmt->tokens[0];
+  unsigned short id, a, b;
+  struct matrix ma, mb, result;
+  double k, determinant;
+  int op, det;
+
+  if (add_row == NULL)
+    choose_kernels ();
+  if ((tp[0] != IDENTIFIER) || (tp[2] != '='))
+    {
+      fputs ("cmd_mat(): unexpected token ", stderr);
+      list_token (tp, stderr);
+      fputc ('\n', stderr);
+      return;
+    }
+  id = tp[1];
+  tp += 3;
+
+  switch ((int) *tp)
+    {
+    case ZER:
+    case CON:
+    case IDN:
+      mat_constant (id, tp[0], &tp[1]);
+      return;
+
+    case TRN:
+    case INV:
+      op = tp[0];
+      a = tp[3];
+      if (find_matrix (a, &ma, 0))
+	return;
+      if (op == TRN)
+	{
+	  if (new_matrix (&result, ma.columns, ma.rows, 0))
+	    return;
+	  transpose (&result, &ma);
+	  store_matrix (id, &result);
+	  return;
+	}
+      if (ma.vector || (ma.rows != ma.columns))
+	{
+	  printf ("ERROR - MAT: %s IS NOT A SQUARE MATRIX\n",
+		  name_table[a]->contents);
+	  executing = 0;
+	  return;
+	}
+      if (new_matrix (&result, ma.rows, ma.columns, 0))
+	return;
+      if (invert (&result, &ma, &determinant))
+	{
+	  free (result.base);
+	  return;
+	}
+      /* The determinant is left in DET, as in Dartmouth BASIC */
+      det = find_var_name ("DET");
+      if (det < 0)
+	{
+	  free (result.base);
+	  executing = 0;
+	  return;
+	}
+      variable_values[det].num = determinant;
+      if (determinant == 0.0)
+	{
+	  free (result.base);
+	  puts ("ERROR - MAT: MATRIX IS SINGULAR");
+	  executing = 0;
+	  return;
+	}
+      store_matrix (id, &result);
+      return;
+
+    case '(':
+      /* Skip the '(' and NUMEXPR tokens */
+      tp += 2;
+      k = eval_number (&tp);
+      if ((tp[0] != ')') || (tp[1] != '*') || (tp[2] != IDENTIFIER))
+	{
+	  fputs ("cmd_mat(): unexpected token ", stderr);
+	  list_token (tp, stderr);
+	  fputc ('\n', stderr);
+	  return;
+	}
+      a = tp[3];
+      if (find_matrix (a, &ma, 0)
+	  || new_matrix (&result, ma.rows, ma.columns, ma.vector))
+	return;
+      combine (&result, &ma, NULL, k);
+      store_matrix (id, &result);
+      return;
+
+    case IDENTIFIER:
+      a = tp[1];
+      tp += 2;
+      if ((*tp != '+') && (*tp != '-') && (*tp != '*'))
+	{
+	  /* A copy */
+	  if (find_matrix (a, &ma, 0)
+	      || new_matrix (&result, ma.rows, ma.columns, ma.vector))
+	    return;
+	  combine (&result, &ma, NULL, 1.0);
+	  store_matrix (id, &result);
+	  return;
+	}
+      op = tp[0];
+      b = tp[2];
+      if (find_matrix (a, &ma, (op == '*')) || find_matrix (b, &mb, 0))
+	return;
+      if (op == '*')
+	{
+	  if (ma.columns != mb.rows)
+	    {
+	      mismatch (a, b);
+	      return;
+	    }
+	  /* A product with a vector is a vector */
+	  if (new_matrix (&result, ma.rows, mb.columns,
+			  ma.vector || mb.vector))
+	    return;
+	  multiply (&result, &ma, &mb);
+	} else {
+	  if ((ma.rows != mb.rows) || (ma.columns != mb.columns))
+	    {
+	      mismatch (a, b);
+	      return;
+	    }
+	  if (new_matrix (&result, ma.rows, ma.columns, ma.vector))
+	    return;
+	  combine (&result, &ma, &mb, (op == '+') ? 1.0 : -1.0);
+	}
+      store_matrix (id, &result);
+      return;
+
+    default:
+      fputs ("cmd_mat(): unexpected token ", stderr);
+      list_token (tp, stderr);
+      fputc ('\n', stderr);
+      return;
+    }
+}
@@ -94,7 +94,7 @@ cmd_print (struct statement_header *stmt)
 	      current_column = strlen(tail2);
 	    }
 	  /* The string is just temporary; release it now that we're done */
-	  free (str);
+	  release_string (str);
 	  break;
 
 	default:
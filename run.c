@@ -11,58 +11,71 @@
 /* Global data */
 int executing;
 unsigned long current_line = (unsigned long) -1;
-unsigned long current_data_line;
 unsigned short current_statement;
-unsigned short current_data_statement;
-unsigned short current_data_item;
 struct line_header *immediate_line = NULL;
 
 
 /* Constant data */
 
-/* Statement function pointers */
-static const struct {
-  unsigned short token;
-  void (*command) (struct statement_header *);
-} command_table[] = {
-  { BYE, cmd_bye },
-  { CONTINUE, cmd_continue },
-  { DATA, cmd_data },
-  { DEF, cmd_def },
-  { DIM, cmd_dim },
-  { END, cmd_end },
-  { FOR, cmd_for },
-  { GOSUB, cmd_gosub },
-  { GOTO, cmd_goto },
-  { _GOTO_, cmd_goto },
-  { IF, cmd_if },
-  { INPUT, cmd_input },
-  { _LET_, cmd_let },
-  { LET, cmd_let },
-  { LIST, cmd_list },
-  { LOAD, cmd_load },
-  { NEW, cmd_new },
-  { NEXT, cmd_next },
-  { ON, cmd_on },
-  { PAUSE, cmd_pause },
-  { PRINT, cmd_print },
-  { READ, cmd_read },
-  { REM, cmd_rem },
-  { RESTORE, cmd_restore },
-  { RETURN, cmd_return },
-  { RUN, cmd_run },
-  { SAVE, cmd_save },
-  { STOP, cmd_stop },
-  { TRACE, cmd_trace },
+/* Every statement command and the function which executes it.
+ * This list is expanded into both the dispatch table below and,
+ * on GCC, the jump table of the threaded loop in execute(). */
+#define COMMAND_LIST(C) \
+  C (BYE, cmd_bye) \
+  C (CONTINUE, cmd_continue) \
+  C (DATA, cmd_data) \
+  C (DEF, cmd_def) \
+  C (DIM, cmd_dim) \
+  C (END, cmd_end) \
+  C (FOR, cmd_for) \
+  C (GOSUB, cmd_gosub) \
+  C (GOTO, cmd_goto) \
+  C (_GOTO_, cmd_goto) \
+  C (IF, cmd_if) \
+  C (INPUT, cmd_input) \
+  C (_LET_, cmd_let) \
+  C (LET, cmd_let) \
+  C (LIST, cmd_list) \
+  C (LOAD, cmd_load) \
+  C (MAT, cmd_mat) \
+  C (NEW, cmd_new) \
+  C (NEXT, cmd_next) \
+  C (ON, cmd_on) \
+  C (PAUSE, cmd_pause) \
+  C (PRINT, cmd_print) \
+  C (READ, cmd_read) \
+  C (REDIM, cmd_redim) \
+  C (REM, cmd_rem) \
+  C (RESTORE, cmd_restore) \
+  C (RETURN, cmd_return) \
+  C (RUN, cmd_run) \
+  C (SAVE, cmd_save) \
+  C (STOP, cmd_stop) \
+  C (TRACE, cmd_trace)
+
+/* Keyword tokens are numbered consecutively from the first
+ * one bison assigns, so a command token less this base
+ * is a small index into the dispatch table. */
+#define FIRST_TOKEN BYE
+
+/* Statement function pointers, indexed by command token */
+#define COMMAND_ENTRY(token, function) [token - FIRST_TOKEN] = function,
+static void (* const command_table[]) (struct statement_header *) = {
+  COMMAND_LIST (COMMAND_ENTRY)
 };
+#define NUM_COMMANDS (sizeof (command_table) / sizeof (command_table[0]))
 
 
 /* Subroutine stack */
 static struct gosub_stack_s {
   unsigned long previous_line;
   unsigned short previous_statement;
+  struct program_line *previous_pl; /* The line to return to, valid only
+				 * if the program is still the same generation */
+  unsigned long generation;
 } *gosub_stack;
 int gosub_stack_size;
+static int gosub_stack_allocated;
 
 /* FOR...NEXT stack */
 static struct for_stack_s {
@@ -70,10 +83,21 @@ static struct for_stack_s {
   unsigned long for_line;	/* The line containing the FOR statement */
   unsigned short for_statement;	/* The index of the FOR statement itself */
   struct statement_header *for_stmt; /* Pointer to the FOR statement for sanity check */
+  struct program_line *for_pl;	/* The line containing the FOR statement,
+				 * valid only if the program is still
+				 * the same generation */
+  unsigned long generation;
   unsigned short *to_expr;	/* Token pointer to the TO expression */
   unsigned short *step_expr;	/* Token pointer to the STEP expression if one exists; else NULL */
+  double to_value;		/* The TO and STEP values as of the FOR */
+  double step_value;		/* statement, used if fixed_loop_limits */
+  int gosub_level;		/* The depth of the subroutine stack */
 } *for_stack;
 int for_stack_size;
+static int for_stack_allocated;
+
+/* The deepest either stack may grow, or 0 for no limit */
+unsigned long stack_limit = 10000;
 
 
 /* Stop address; preserved only until a CONTINUE
@@ -82,6 +106,23 @@ static unsigned long stop_line;
 static unsigned short stop_statement;
 /* For debugging */
 int tracing = 0;
+/* Whether to run statements through the bytecode engine;
+ * set by RUN FAST, or by default from the command line. */
+int fast_execution = 0;
+int fast_default = 0;
+/* Whether NEXT uses the TO and STEP values computed by FOR
+ * (as Dartmouth BASIC does) instead of evaluating them again. */
+int fixed_loop_limits = 0;
+
+/* The program generation for which statements were last linked */
+static unsigned long linked_generation = 0;
+/* The line being executed.  This is either an entry in the program
+ * index or the pseudo-entry for the immediate (unnumbered) line.
+ * `current_statement' is the index of the next statement on it. */
+static struct program_line *cursor_line;
+static struct program_line immediate_pline;
+/* Don't follow a chain of GOTOs further than this */
+#define MAX_JUMP_CHAIN 16
 
 
 /* Search a given line for the Nth statement */
@@ -103,141 +144,558 @@ find_statement (struct line_header *line, unsigned short statement_number)
   return stmt;
 }
 
-/* Search a line for the Nth statement */
-struct statement_header *
-find_line_statement (unsigned long line_number,
-		     unsigned short statement_number)
+/* If a GOTO, GOSUB, or implied GOTO following THEN/ELSE goes to a
+ * constant line number, return the line it refers to; otherwise NULL. */
+static struct program_line *
+constant_target (struct statement_header *stmt)
 {
-  struct line_header *line;
-  struct statement_header *stmt;
-  int i;
+  unsigned short *tp;
+  unsigned long number;
 
-  line = find_line (line_number, 0);
-  if (line == NULL)
+  if ((stmt->command != GOTO) && (stmt->command != _GOTO_)
+      && (stmt->command != GOSUB))
     return NULL;
-  return find_statement (line, statement_number);
+  tp = &stmt->tokens[0];
+  if (*tp++ != INTEGER)
+    return NULL;
+  number = *((unsigned long *) tp);
+  /* The line number must be the entire expression */
+  tp = (unsigned short *) &((unsigned long *) tp)[1];
+  if ((*tp != ':') && (*tp != '\n') && (*tp != ELSE))
+    return NULL;
+  return find_program_line (number, 0);
 }
 
-/* Execute the next statement */
+/* Build the table of statements on a line, binding any GOTO,
+ * GOSUB, THEN, or ELSE with a constant line number to that line. */
 static void
-execute_statement (struct statement_header *stmt)
+build_statement_table (struct program_line *pl)
 {
+  struct statement_header *stmt;
   int i;
 
-  for (i = 0; i < sizeof (command_table) / sizeof (command_table[0]); i++)
+  /* Count the statements on the line */
+  pl->num_statements = 0;
+  for (stmt = &pl->line->statement[0];
+       (char *) stmt < &((char *) pl->line)[pl->line->length];
+       stmt = (struct statement_header *) &((char *) stmt)[stmt->length])
+    pl->num_statements++;
+  free_line_code (pl);
+  free (pl->statement);
+  pl->statement = (struct statement_info *) calloc
+    (pl->num_statements, sizeof (struct statement_info));
+  for (i = 0, stmt = &pl->line->statement[0]; i < pl->num_statements;
+       i++, stmt = (struct statement_header *) &((char *) stmt)[stmt->length])
+    {
+      pl->statement[i].stmt = stmt;
+      pl->statement[i].target = constant_target (stmt);
+    }
+}
+
+/* If a target line does nothing but go to another line,
+ * go directly to the final destination instead. */
+static void
+link_destinations (struct program_line *pl)
+{
+  struct program_line *dest;
+  int i, hops;
+
+  for (i = 0; i < pl->num_statements; i++)
     {
-      if (command_table[i].token == stmt->command)
+      dest = pl->statement[i].target;
+      for (hops = 0; (dest != NULL) && (hops < MAX_JUMP_CHAIN); hops++)
 	{
-	  if (tracing & TRACE_STATEMENTS)
-	    {
-	      list_statement (stmt, stderr);
-	      // Print a newline if the statement does not already end with one
-	      unsigned short *tail_tp = (unsigned short *)
-		&((char *) stmt)[stmt->length - sizeof(short)];
-	      if (*tail_tp != '\n')
-		fputc('\n', stderr);
-	    }
-	  command_table[i].command (stmt);
-	  return;
+	  if ((dest->statement[0].stmt->command != GOTO)
+	      || (dest->statement[0].target == NULL))
+	    break;
+	  dest = dest->statement[0].target;
 	}
+      pl->statement[i].destination = dest;
     }
+}
+
+/* Return the variable list of a NEXT statement, or NULL if it has
+ * something other than simple variables.  *VARS is set to the
+ * variable indices, in order. */
+static struct list_header *
+next_variables (struct statement_header *stmt, unsigned short *vars)
+{
+  struct list_header *var_list;
+  struct list_item *var_item;
+  unsigned short *tp;
+  int i;
+
+  if (stmt->tokens[0] != ITEMLIST)
+    return NULL;
+  var_list = (struct list_header *) &stmt->tokens[1];
+  if (var_list->num_items > 32)
+    return NULL;
+  var_item = &var_list->item[0];
+  for (i = 0; i < var_list->num_items; i++)
+    {
+      if (var_item->tokens[0] != IDENTIFIER)
+	return NULL;
+      vars[i] = var_item->tokens[1];
+      tp = (unsigned short *) &((char *) var_item)[var_item->length];
+      if ((i + 1 < var_list->num_items) && (*tp != ','))
+	return NULL;
+      var_item = (struct list_item *) (++tp);
+    }
+  return var_list;
+}
+
+/* Pair each FOR statement with the NEXT statements which end it.
+ *
+ * For a loop that runs zero times, cmd_for() skips ahead to the first
+ * NEXT which names its variable (or names none); working backwards
+ * through the program, we can find that for every FOR at once.  A NEXT
+ * with anything unusual in it stops the pairing of any FOR before it,
+ * so cmd_for() will search for itself and report the problem.
+ *
+ * Going forwards, each NEXT with at most one variable is paired with
+ * the innermost open FOR of that variable, so cmd_next() can check
+ * the top of the FOR stack directly.  Control flow may not follow the
+ * text, so both pairings are only hints that are checked at run time. */
+static void
+pair_loops (void)
+{
+  struct loop_position {
+    struct program_line *pl;
+    unsigned short statement, item;
+    unsigned long sequence;	/* Position in the whole program */
+  } *nearest, nearest_any, *open_for, *found;
+  struct program_line **lines, *pl;
+  struct statement_header *stmt;
+  struct statement_info *info;
+  struct list_header *var_list;
+  unsigned short vars[32];
+  unsigned long sequence;
+  int num_lines, num_statements, num_open, l, i, j, k;
+
+  if (program_size == 0)
+    return;
+  lines = (struct program_line **) malloc
+    (sizeof (struct program_line *) * program_size);
+  num_lines = num_statements = 0;
+  for (pl = find_program_line (0, 1); pl != NULL; pl = pl->next[0])
+    {
+      lines[num_lines++] = pl;
+      num_statements += pl->num_statements;
+    }
+
+  /* Backwards: the NEXT each FOR skips to */
+  nearest = (struct loop_position *) calloc
+    (name_table_size, sizeof (struct loop_position));
+  nearest_any.pl = NULL;
+  sequence = (unsigned long) -1;
+  for (l = num_lines - 1; l >= 0; l--)
+    for (i = lines[l]->num_statements - 1; i >= 0; i--, sequence--)
+      {
+	info = &lines[l]->statement[i];
+	stmt = info->stmt;
+	if (stmt->command == NEXT)
+	  {
+	    var_list = next_variables (stmt, vars);
+	    if (var_list == NULL)
+	      {
+		memset (nearest, 0,
+			name_table_size * sizeof (struct loop_position));
+		nearest_any.pl = NULL;
+		continue;
+	      }
+	    for (k = var_list->num_items - 1; k >= 0; k--)
+	      {
+		nearest[vars[k]].pl = lines[l];
+		nearest[vars[k]].statement = i;
+		nearest[vars[k]].item = k;
+		nearest[vars[k]].sequence = sequence;
+	      }
+	    if (var_list->num_items == 0)
+	      {
+		nearest_any.pl = lines[l];
+		nearest_any.statement = i;
+		nearest_any.item = 0;
+		nearest_any.sequence = sequence;
+	      }
+	  }
+	else if ((stmt->command == FOR) && (stmt->tokens[1] == IDENTIFIER))
+	  {
+	    found = &nearest[stmt->tokens[2]];
+	    if ((found->pl == NULL) || ((nearest_any.pl != NULL)
+					&& (nearest_any.sequence
+					    < found->sequence)))
+	      found = &nearest_any;
+	    info->loop_line = found->pl;
+	    info->loop_statement = found->statement;
+	    info->loop_item = found->item;
+	  }
+      }
+  free (nearest);
+
+  /* Forwards: the FOR each NEXT ends */
+  open_for = (struct loop_position *) malloc
+    (sizeof (struct loop_position) * (num_statements + 1));
+  num_open = 0;
+  for (l = 0; l < num_lines; l++)
+    for (i = 0; i < lines[l]->num_statements; i++)
+      {
+	info = &lines[l]->statement[i];
+	stmt = info->stmt;
+	if ((stmt->command == FOR) && (stmt->tokens[1] == IDENTIFIER))
+	  {
+	    /* Keep track of the variable in the `item' field */
+	    open_for[num_open].pl = lines[l];
+	    open_for[num_open].statement = i;
+	    open_for[num_open].item = stmt->tokens[2];
+	    num_open++;
+	    continue;
+	  }
+	if ((stmt->command != NEXT)
+	    || ((var_list = next_variables (stmt, vars)) == NULL))
+	  continue;
+	if (var_list->num_items == 0)
+	  {
+	    if (num_open > 0)
+	      {
+		num_open--;
+		info->loop_line = open_for[num_open].pl;
+		info->loop_statement = open_for[num_open].statement;
+	      }
+	    continue;
+	  }
+	for (k = 0; k < var_list->num_items; k++)
+	  {
+	    for (j = num_open - 1; j >= 0; j--)
+	      if (open_for[j].item == vars[k])
+		break;
+	    if (j < 0)
+	      continue;
+	    if (var_list->num_items == 1)
+	      {
+		info->loop_line = open_for[j].pl;
+		info->loop_statement = open_for[j].statement;
+	      }
+	    num_open = j;
+	  }
+      }
+  free (open_for);
+  free (lines);
+}
+
+/* Build the statement table of every line in the program.  This only
+ * needs to be done once after the program has been changed; the tables
+ * are discarded whenever a line is added or removed. */
+static void
+link_program (void)
+{
+  struct program_line *pl;
+
+  if (linked_generation == program_generation)
+    return;
+  /* All compiled code is about to be thrown away */
+  jit_reset ();
+  for (pl = find_program_line (0, 1); pl != NULL; pl = pl->next[0])
+    build_statement_table (pl);
+  for (pl = find_program_line (0, 1); pl != NULL; pl = pl->next[0])
+    link_destinations (pl);
+  pair_loops ();
+  linked_generation = program_generation;
+}
+
+/* Move execution to the given statement index of a line.
+ * If there is no such line, we've run off the end of the program. */
+static void
+set_position (struct program_line *pl, unsigned short statement)
+{
+  if (pl == NULL)
+    {
+      cmd_end (NULL);
+      /* Leave the cursor somewhere harmless */
+      pl = &immediate_pline;
+      statement = immediate_pline.num_statements;
+    }
+  cursor_line = pl;
+  current_line = pl->line->line_number;
+  current_statement = statement;
+}
+
+/* Find the line for a line number saved on the GOSUB or FOR stack,
+ * or the immediate line for an unnumbered line. */
+static struct program_line *
+saved_line (unsigned long number, int after)
+{
+  if (number == (unsigned long) -1)
+    return &immediate_pline;
+  return find_program_line (number, after);
+}
+
+/* Return the cached information for the statement being executed,
+ * or NULL if it isn't the current statement of the cursor line. */
+static struct statement_info *
+current_info (struct statement_header *stmt)
+{
+  struct statement_info *info;
+
+  if ((current_statement < 1)
+      || (current_statement > cursor_line->num_statements))
+    return NULL;
+  info = &cursor_line->statement[current_statement - 1];
+  return (info->stmt == stmt) ? info : NULL;
+}
+
+/* Return the line that the current GOTO or GOSUB statement was
+ * bound to by link_program(), or NULL if it has to be evaluated. */
+static struct program_line *
+bound_line (struct statement_header *stmt)
+{
+  struct statement_info *info;
+
+  info = current_info (stmt);
+  if ((info == NULL) || (info->target == NULL))
+    return NULL;
+  /* Skip the intermediate lines unless the user wants to see them */
+  if (tracing & (TRACE_LINES | TRACE_STATEMENTS))
+    return info->target;
+  return info->destination;
+}
+
+/* Trace a statement about to be executed, if requested */
+static void
+trace_statement (struct statement_header *stmt)
+{
+  list_statement (stmt, stderr);
+  // Print a newline if the statement does not already end with one
+  unsigned short *tail_tp = (unsigned short *)
+    &((char *) stmt)[stmt->length - sizeof(short)];
+  if (*tail_tp != '\n')
+    fputc('\n', stderr);
+}
+
+/* Report a statement we don't know how to execute */
+static void
+unhandled_statement (struct statement_header *stmt)
+{
   fputs ("Unhandled command: ", stderr);
   list_token (&stmt->command, stderr);
   fputc ('\n', stderr);
 }
 
+/* Execute the next statement */
+void
+execute_statement (struct statement_header *stmt)
+{
+  unsigned int index = stmt->command - FIRST_TOKEN;
+
+  if ((index >= NUM_COMMANDS) || (command_table[index] == NULL))
+    {
+      unhandled_statement (stmt);
+      return;
+    }
+  if (tracing & TRACE_STATEMENTS)
+    trace_statement (stmt);
+  command_table[index] (stmt);
+  /* Nothing needs the statement's temporary strings any longer */
+  reset_scratch ();
+}
+
+/* Advance the cursor to the next statement to execute and return it,
+ * or return NULL if execution has stopped or run off the end.
+ * The position of the statement is saved in *last_pl and
+ * *last_statement for finish_statement() to compare against. */
+static inline struct statement_header *
+next_statement (struct line_header *command_line,
+		struct program_line **last_pl, unsigned short *last_statement)
+{
+  struct statement_header *stmt;
+
+  if (!executing)
+    return NULL;
+  /* If we've reached the end of this line, go on to the next. */
+  if (current_statement >= cursor_line->num_statements)
+    {
+      if ((cursor_line == &immediate_pline)
+	  || (cursor_line->next[0] == NULL))
+	{
+	  /* End of program */
+	  cmd_end (command_line->statement);
+	  return NULL;
+	}
+      set_position (cursor_line->next[0], 0);
+    }
+
+  stmt = cursor_line->statement[current_statement].stmt;
+  if ((tracing & TRACE_LINES) && (current_statement == 0))
+    list_line (cursor_line->line, stderr);
+  current_statement++;
+  *last_pl = cursor_line;
+  *last_statement = current_statement;
+  return stmt;
+}
+
+/* Execute a statement with the bytecode engine.  Expressions are
+ * traced by the interpreter, so traced statements go there instead. */
+static inline void
+run_statement (struct statement_header *stmt,
+	       struct program_line *last_pl, unsigned short last_statement)
+{
+  if (tracing & (TRACE_STATEMENTS | TRACE_EXPRESSIONS))
+    execute_statement (stmt);
+  else
+    execute_compiled (last_pl, last_statement - 1);
+}
+
+/* Clean up after a statement has been executed */
+static inline void
+finish_statement (struct statement_header *stmt,
+		  struct program_line *last_pl, unsigned short last_statement)
+{
+  unsigned short *tail_tp = (unsigned short *)
+    &((char *) stmt)[stmt->length - sizeof(short)];
+  /* If we haven't changed position (yet), check
+   * whether the statement ends in an ELSE token;
+   * in that case we can skip the rest of the line. */
+  if ((cursor_line == last_pl) && (current_statement == last_statement)
+      && (*tail_tp == ELSE))
+    current_statement = cursor_line->num_statements;
+  /* Reset the stop position on a change of position */
+  if ((cursor_line != last_pl) || (current_statement != last_statement))
+    stop_line = (unsigned long) -1;
+  /* Nothing needs the statement's temporary strings any longer */
+  reset_scratch ();
+}
+
 /* Execute the statements in a line */
 void
 execute (struct line_header *command_line)
 {
-  struct line_header *line;
   struct statement_header *stmt;
-  unsigned long last_line;
+  struct program_line *last_pl;
   unsigned short last_statement;
 
+  link_program ();
+  immediate_pline.line = command_line;
+  compile_postfix (command_line);
+  build_statement_table (&immediate_pline);
+  link_destinations (&immediate_pline);
   executing = 1;
-  line = command_line;
-  current_statement = 0;
-  current_line = line->line_number;
-  stmt = &line->statement[0];
-  while (executing)
+  set_position (&immediate_pline, 0);
+
+#ifdef __GNUC__
+  /* Direct-threaded dispatch: each command gets its own copy of the
+   * jump to the next one, which gives the branch predictor a
+   * separate history for what usually follows each statement. */
+#define COMMAND_LABEL(token, function) [token - FIRST_TOKEN] = &&do_##token,
+  static void * const label_table[] = {
+    COMMAND_LIST (COMMAND_LABEL)
+  };
+  unsigned int index;
+
+#define DISPATCH()							\
+  do {									\
+    stmt = next_statement (command_line, &last_pl, &last_statement);	\
+    if (stmt == NULL)							\
+      goto done;							\
+    if (tracing & TRACE_STATEMENTS)					\
+      goto traced;							\
+    if (fast_execution)							\
+      goto compiled;							\
+    index = stmt->command - FIRST_TOKEN;				\
+    if ((index >= NUM_COMMANDS) || (label_table[index] == NULL))	\
+      goto unhandled;							\
+    goto *label_table[index];						\
+  } while (0)
+#define COMMAND_CASE(token, function)					\
+  do_##token:								\
+    function (stmt);							\
+    finish_statement (stmt, last_pl, last_statement);			\
+    DISPATCH ();
+
+  DISPATCH ();
+  COMMAND_LIST (COMMAND_CASE)
+
+ traced:
+  /* Tracing is rare enough that it can go through the plain table */
+  execute_statement (stmt);
+  finish_statement (stmt, last_pl, last_statement);
+  DISPATCH ();
+
+ compiled:
+  run_statement (stmt, last_pl, last_statement);
+  finish_statement (stmt, last_pl, last_statement);
+  DISPATCH ();
+
+ unhandled:
+  unhandled_statement (stmt);
+  finish_statement (stmt, last_pl, last_statement);
+  DISPATCH ();
+
+ done:
+#undef COMMAND_CASE
+#undef DISPATCH
+#undef COMMAND_LABEL
+
+#else /* ! __GNUC__ */
+  while ((stmt = next_statement (command_line, &last_pl, &last_statement))
+	 != NULL)
     {
-      if ((tracing & TRACE_LINES) && (current_statement == 0))
-	list_line (line, stderr);
-      current_statement++;
-      last_line = current_line;
-      last_statement = current_statement;
-      execute_statement (stmt);
-      unsigned short *tail_tp = (unsigned short *)
-	&((char *) stmt)[stmt->length - sizeof(short)];
-      /* If we haven't changed position (yet), check
-       * whether the statement ends in an ELSE token;
-       * in that case we can skip the rest of the line. */
-      if ((current_line == last_line) && (current_statement == last_statement)
-	  && (*tail_tp == ELSE))
-	{
-	  current_line++;
-	  current_statement = 0;
-	}
-      /* Check for a change of position */
-      if ((current_line != last_line) || (current_statement != last_statement))
-	{
-	  /* Reset the stop position */
-	  stop_line = (unsigned long) -1;
-	  /* Find out where the next statement is */
-	  if (current_line == (unsigned long) -1)
-	    line = command_line;
-	  else
-	    {
-	      line = find_line (current_line, 1);
-	      if (line == NULL)
-		{
-		  /* End of program */
-		  cmd_end (command_line->statement);
-		  break;
-		}
-	      if (line->line_number != current_line)
-		{
-		  current_line = line->line_number;
-		  current_statement = 0;
-		}
-	    }
-	}
-
-      /* Get the next statement */
-      stmt = find_statement (line, current_statement);
-      /* If we've reached the end of this line, go on to the next. */
-      if (stmt == NULL)
-	{
-	  line = (current_line == (unsigned long) -1) ? NULL
-	    : find_line (++current_line, 1);
-	  if (line == NULL)
-	    {
-	      /* End of program */
-	      cmd_end (command_line->statement);
-	      break;
-	    }
-	  current_line = line->line_number;
-	  current_statement = 0;
-	  stmt = &line->statement[0];
-	}
+      if (fast_execution)
+	run_statement (stmt, last_pl, last_statement);
+      else
+	execute_statement (stmt);
+      finish_statement (stmt, last_pl, last_statement);
     }
+#endif /* ! __GNUC__ */
+
+  free_line_code (&immediate_pline);
+  free_postfix (command_line);
+  free (immediate_pline.statement);
+  immediate_pline.statement = NULL;
+  immediate_pline.num_statements = 0;
 
   /* End of execution; print "READY". */
   /* FIX ME: This should only be done if the program terminated normally. */
   puts ("\nREADY");
 }
 
-/* Push the current program location on the subroutine stack */
-static void
+/* Make room for one more entry on the subroutine or FOR...NEXT
+ * stack, doubling its allocation whenever it is full.  Returns 0
+ * (after reporting the error) if the stack is already as deep
+ * as stack_limit allows. */
+static int
+grow_stack (void **stack, int *allocated, int size, size_t entry_size,
+	    const char *what)
+{
+  if (stack_limit && ((unsigned long) size >= stack_limit))
+    {
+      printf ("ERROR - %s NESTED DEEPER THAN %lu\n", what, stack_limit);
+      executing = 0;
+      return 0;
+    }
+  if (size >= *allocated)
+    {
+      *allocated = *allocated ? (*allocated * 2) : 16;
+      *stack = realloc (*stack, entry_size * *allocated);
+    }
+  return 1;
+}
+
+/* Push the current program location on the subroutine stack.
+ * Returns 0 if the stack is full. */
+static int
 push_sub (void)
 {
-  gosub_stack = (struct gosub_stack_s *) realloc
-    (gosub_stack, sizeof (struct gosub_stack_s) * ++gosub_stack_size);
-  memmove (&gosub_stack[1], gosub_stack,
-	   sizeof (struct gosub_stack_s) * (gosub_stack_size - 1));
-  gosub_stack->previous_line = current_line;
-  gosub_stack->previous_statement = current_statement;
+  struct gosub_stack_s *gs;
+
+  if (!grow_stack ((void **) &gosub_stack, &gosub_stack_allocated,
+		   gosub_stack_size, sizeof (struct gosub_stack_s),
+		   "GOSUB: SUBROUTINES"))
+    return 0;
+  gs = &gosub_stack[gosub_stack_size++];
+  gs->previous_line = current_line;
+  gs->previous_statement = current_statement;
+  gs->previous_pl = cursor_line;
+  gs->generation = program_generation;
+  return 1;
 }
 
 void
@@ -250,10 +708,19 @@ void
 cmd_continue (struct statement_header *stmt)
 {
   /* Do nothing if the program has not stopped */
+  struct program_line *pl;
+
   if (stop_line == (unsigned long) -1)
     return;
-  current_line = stop_line;
-  current_statement = stop_statement;
+  pl = find_program_line (stop_line, 1);
+  if (pl == NULL)
+    {
+      /* The rest of the program has been deleted */
+      cmd_end (stmt);
+      return;
+    }
+  set_position (pl, (pl->line->line_number == stop_line)
+		? stop_statement : 0);
   executing = 1;
 }
 
@@ -271,51 +738,57 @@ cmd_end (struct statement_header *stmt)
 void
 cmd_gosub (struct statement_header *stmt)
 {
-  struct line_header *line;
+  struct program_line *pl;
   unsigned long number;
   unsigned short *tp;
 
-  /* Evaluate the line number expression */
-  tp = &stmt->tokens[0];
-  number = (unsigned long) eval_number (&tp);
-  line = find_line (number, 0);
-  if (line == NULL)
+  pl = bound_line (stmt);
+  if (pl == NULL)
     {
-      printf ("ERROR - GOSUB: NO LINE %u\n", number);
-      executing = 0;
-      return;
+      /* Evaluate the line number expression */
+      tp = &stmt->tokens[0];
+      number = (unsigned long) eval_number (&tp);
+      pl = find_program_line (number, 0);
+      if (pl == NULL)
+	{
+	  printf ("ERROR - GOSUB: NO LINE %u\n", number);
+	  executing = 0;
+	  return;
+	}
     }
-  push_sub ();
-  current_line = line->line_number;
-  current_statement = 0;
+  if (push_sub ())
+    set_position (pl, 0);
 }
 
 void
 cmd_goto (struct statement_header *stmt)
 {
-  struct line_header *line;
+  struct program_line *pl;
   unsigned long number;
   unsigned short *tp;
 
-  /* Evaluate the line number expression */
-  tp = &stmt->tokens[0];
-  number = (unsigned long) eval_number (&tp);
-  line = find_line (number, 0);
-  if (line == NULL)
+  pl = bound_line (stmt);
+  if (pl == NULL)
     {
-      printf ("ERROR - GOTO: NO LINE %u\n", number);
-      executing = 0;
-      return;
+      /* Evaluate the line number expression */
+      tp = &stmt->tokens[0];
+      number = (unsigned long) eval_number (&tp);
+      pl = find_program_line (number, 0);
+      if (pl == NULL)
+	{
+	  printf ("ERROR - GOTO: NO LINE %u\n", number);
+	  executing = 0;
+	  return;
+	}
     }
-  current_line = line->line_number;
-  current_statement = 0;
+  set_position (pl, 0);
 }
 
 void
 cmd_on (struct statement_header *stmt)
 {
   int i, index, op;
-  struct line_header *line;
+  struct program_line *pl;
   unsigned long number;
   unsigned short *tp;
 
@@ -359,18 +832,17 @@ cmd_on (struct statement_header *stmt)
 
   /* Get the line number */
   number = *((unsigned long *) &((struct list_item *) tp)->tokens[1]);
-  line = find_line (number, 0);
-  if (line == NULL)
+  pl = find_program_line (number, 0);
+  if (pl == NULL)
     {
       printf ("ERROR - ON..%s: NO LINE %u\n",
 	      (op == GOTO) ? "GOTO" : "GOSUB", number);
       executing = 0;
       return;
     }
-  if (op == GOSUB)
-    push_sub ();
-  current_line = line->line_number;
-  current_statement = 0;
+  if ((op == GOSUB) && !push_sub ())
+    return;
+  set_position (pl, 0);
 }
 
 void
@@ -414,26 +886,22 @@ cmd_restore (struct statement_header *stmt)
   unsigned short *tp = &stmt->tokens[0];
   if ((*tp != ':') && (*tp != '\n') && (*tp != ELSE))
     {
-      struct line_header *line;
-      int number;
+      unsigned long number;
 
       /* Evaluate the numeric expression */
       number = (unsigned long) eval_number (&tp);
-      line = find_line (number, 1);
-      current_data_line = ((line == NULL)
-			   ? (unsigned long) -1
-			   : line->line_number);
+      restore_data (number);
     } else {
-      current_data_line = 0;
+      restore_data (0);
     }
-  current_data_statement = 0;
-  current_data_item = 0;
 }
 
 void
 cmd_return (struct statement_header *stmt)
 {
-  struct line_header *line;
+  struct program_line *pl;
+  struct gosub_stack_s *gs;
+  unsigned long line_number;
 
   /* Make sure we have a place to go! */
   if (gosub_stack_size <= 0)
@@ -442,27 +910,26 @@ cmd_return (struct statement_header *stmt)
       executing = 0;
       return;
     }
+  gs = &gosub_stack[--gosub_stack_size];
 
   /* Return to the next level on the subroutine stack */
-  current_line = gosub_stack->previous_line;
-  current_statement = gosub_stack->previous_statement;
-  memmove (gosub_stack, &gosub_stack[1],
-	   sizeof (struct gosub_stack_s) * --gosub_stack_size);
-
-  /* Make sure the line still exists */
-  line = find_line (current_line, 1);
-  if (line == NULL)
-    {
-      /* End of program */
-      current_line = (unsigned long) -1;
-      executing = 0;
-      return;
-    }
-  if (line->line_number != current_line)
+  if (gs->generation == program_generation)
+    set_position (gs->previous_pl, gs->previous_statement);
+  else
     {
-      /* Return line has been deleted; go to the next one. */
-      current_line = line->line_number;
-      current_statement = 0;
+      /* The program has changed; make sure the line still exists */
+      line_number = gs->previous_line;
+      pl = saved_line (line_number, 1);
+      if (pl == NULL)
+	{
+	  /* End of program */
+	  current_line = (unsigned long) -1;
+	  executing = 0;
+	}
+      else
+	/* If the return line has been deleted, go to the next one. */
+	set_position (pl, (pl->line->line_number == line_number)
+		      ? gs->previous_statement : 0);
     }
 }
 
@@ -471,38 +938,35 @@ cmd_run (struct statement_header *stmt)
 {
   int i;
 
+  /* RUN FAST selects the bytecode engine for this run */
+  fast_execution = fast_default || (stmt->tokens[0] == FAST);
+
   /* Restore the program state to initial values */
-  current_line = 0;
-  current_statement = 0;
-  cmd_restore (stmt);
+  restore_data (0);
 
   /* Zero all variables */
   for (i = 0; i < name_table_size; i++)
     {
       if (name_table[i]->contents[name_table[i]->length - 1] == '$')
 	{
-	  if (variable_values[i].str != NULL)
-	    {
-	      free (variable_values[i].str);
-	      variable_values[i].str = NULL;
-	    }
+	  release_string (variable_values[i].str);
+	  variable_values[i].str = NULL;
 	} else {
 	  variable_values[i].num = 0.0;
 	}
     }
 
-  /* Remove all functions */
+  /* Remove all functions and arrays */
   for (i = 0; i < function_table_size; i++)
-    {
-      if (function_table[i].expr != NULL)
-	free (function_table[i].expr);
-    }
+    free_function (&function_table[i]);
   function_table_size = 0;
   /* But keep the built-in ones */
   initialize_builtin_functions ();
 
   /* Start executing */
-  executing = 1;
+  set_position (find_program_line (0, 1), 0);
+  if (current_line != (unsigned long) -1)
+    executing = 1;
 }
 
 void
@@ -537,13 +1001,22 @@ cmd_if (struct statement_header *stmt)
       return;
     }
 
+  if_branch ((struct statement_header *) tp, condition);
+}
+
+/* Continue after an IF whose condition has been evaluated.
+ * `stmt' is the statement following the THEN. */
+void
+if_branch (struct statement_header *stmt, double condition)
+{
+  unsigned short terminator;
+
   /* Continue to the next statement if the condition is true;
    * if the condition is false, search for an ELSE on this line,
    * or go to the next line if there is no ELSE. */
   if (condition != 0.0)
     return;
   current_statement++;
-  stmt = (struct statement_header *) tp;
   terminator = *((unsigned short *) &((char *) stmt)[stmt->length - sizeof (short)]);
   if ((stmt->command == _GOTO_) && (terminator == ':')) {
     /* Exception: if the statement has an implied GOTO (i.e. THEN ##)
@@ -567,17 +1040,16 @@ cmd_if (struct statement_header *stmt)
     fprintf (stderr, "Line %d statement %d ends in unexpected token %04X\n",
 	     current_line, current_statement, terminator);
     // Skip to the next line
-    current_line++;
-    current_statement = 0;
+    current_statement = cursor_line->num_statements;
     return;
   }
   /* fall through when the end of the line is encountered; go to the next line. */
-  current_line++;
-  current_statement = 0;
+  current_statement = cursor_line->num_statements;
 }
 
 // Defined later on down
 int evaluate_next (const int var);
+static int step_loop (struct for_stack_s *fs);
 
 void
 cmd_for (struct statement_header *stmt)
@@ -585,9 +1057,9 @@ cmd_for (struct statement_header *stmt)
   unsigned short *tp;
   int i, var, status;
   double to_value, step_value;
-  struct line_header *line;
   struct list_header *var_list;
   struct list_item *var_item;
+  struct statement_info *info;
 
   /* Get the variable index.  Note that the order of tokens is:
    * FOR: NUMLVAL, IDENTIFIER, name index, '=', NUMEXPR, ...
@@ -597,19 +1069,41 @@ cmd_for (struct statement_header *stmt)
   /* Skip past the '=' and NUMEXPR tokens */
   tp += 2;
 
+  /* If the program comes back to a FOR on a variable which is
+   * already being iterated at this level of subroutine (by GOTO,
+   * or by running the FOR in a subroutine again after leaving the
+   * loop by RETURN), reuse that entry instead of leaving it behind.
+   * Any loops started inside the old one are abandoned with it. */
+  for (i = for_stack_size - 1; i >= 0; --i)
+    {
+      if (for_stack[i].gosub_level < gosub_stack_size)
+	break;
+      if (for_stack[i].var_index == var)
+	{
+	  for_stack_size = i;
+	  break;
+	}
+    }
+
   /* Push the iteration variable and location of the FOR statement
    * onto the FOR...NEXT stack. */
-  //push_for (var);
-  for_stack = (struct for_stack_s *) realloc
-    (for_stack, sizeof (struct for_stack_s) * ++for_stack_size);
+  if (!grow_stack ((void **) &for_stack, &for_stack_allocated,
+		   for_stack_size, sizeof (struct for_stack_s),
+		   "FOR: LOOPS"))
+    return;
+  ++for_stack_size;
   for_stack[for_stack_size-1].var_index = var;
   for_stack[for_stack_size-1].for_line = current_line;
   /* Make sure we save the FOR statement itself,
    * NOT the following statement! */
   for_stack[for_stack_size-1].for_statement = current_statement - 1;
   for_stack[for_stack_size-1].for_stmt = stmt;
+  for_stack[for_stack_size-1].for_pl = cursor_line;
+  for_stack[for_stack_size-1].generation = program_generation;
   for_stack[for_stack_size-1].to_expr = NULL;	/* Will determine after evaluating the initial value */
   for_stack[for_stack_size-1].step_expr = NULL;	/* Will fill in later if STEP is present */
+  for_stack[for_stack_size-1].step_value = 1.0;
+  for_stack[for_stack_size-1].gosub_level = gosub_stack_size;
 
   /* Assign the result of the first expression */
   variable_values[var].num = eval_number (&tp);
@@ -630,6 +1124,7 @@ cmd_for (struct statement_header *stmt)
 
   /* Evaluate the TO end of the statement */
   to_value = eval_number (&tp);
+  for_stack[for_stack_size-1].to_value = to_value;
   /* tp should now be pointing to either a STEP token
    * or an end-of-statement token. */
   if ((*tp != STEP) && (*tp != '\n') && (*tp != ':') && (*tp != ELSE))
@@ -645,6 +1140,7 @@ cmd_for (struct statement_header *stmt)
       for_stack[for_stack_size-1].step_expr = tp;
       /* Evaluate the STEP */
       step_value = eval_number (&tp);
+      for_stack[for_stack_size-1].step_value = step_value;
     } else {
       /* The default step is always 1; some programs depend on this. */
       step_value = 1.0;
@@ -658,24 +1154,40 @@ cmd_for (struct statement_header *stmt)
     /* If we're not past the end, proceed normally. */
     return;
 
+  /* link_program() has usually found the NEXT already */
+  info = current_info (stmt);
+  if ((info != NULL) && (info->loop_line != NULL))
+    {
+      set_position (info->loop_line, info->loop_statement + 1);
+      stmt = info->loop_line->statement[info->loop_statement].stmt;
+      var_list = (struct list_header *) &stmt->tokens[1];
+      if (var_list->num_items == 0)
+	{
+	  --for_stack_size;
+	  return;
+	}
+      var_item = &var_list->item[0];
+      for (i = 0; i < info->loop_item; i++)
+	var_item = (struct list_item *)
+	  &((char *) var_item)[var_item->length + sizeof (short)];
+      goto found_next;
+    }
+
   // Need to locate the NEXT statement matching this FOR variable
   while (1)
     {
-      stmt = find_line_statement(current_line, current_statement);
-      if (stmt == NULL)
+      if (current_statement >= cursor_line->num_statements)
 	{
-	  line = (current_line == (unsigned long) -1)
-	    ? NULL : find_line(++current_line, 1);
-	  if (line == NULL)
+	  if ((cursor_line == &immediate_pline)
+	      || (cursor_line->next[0] == NULL))
 	    {
 	      /* End of program */
 	      cmd_end (for_stack[for_stack_size-1].for_stmt);
 	      return;
 	    }
-	  current_line = line->line_number;
-	  current_statement = 0;
-	  stmt = &line->statement[0];
+	  set_position (cursor_line->next[0], 0);
 	}
+      stmt = cursor_line->statement[current_statement].stmt;
       current_statement++;
       if (stmt->command != NEXT)
 	continue;
@@ -729,6 +1241,7 @@ cmd_for (struct statement_header *stmt)
     skip_statement:
       continue;
     }
+ found_next:
   /* Pop the FOR...NEXT stack. */
   --for_stack_size;
   /* If we have any more identifiers in this NEXT statement,
@@ -769,6 +1282,8 @@ cmd_next (struct statement_header *stmt)
   unsigned short *tp;
   struct list_header *list;
   struct list_item *next_var;
+  struct statement_info *info;
+  struct for_stack_s *fs;
   int i, var, status;
 
   tp = &stmt->tokens[0];
@@ -788,6 +1303,24 @@ cmd_next (struct statement_header *stmt)
       return;
     }
 
+  /* If this NEXT ends the innermost loop, as link_program() expects,
+   * we can go straight to the end-of-loop test. */
+  info = current_info (stmt);
+  if ((info != NULL) && (info->loop_line != NULL) && (list->num_items <= 1))
+    {
+      fs = &for_stack[for_stack_size-1];
+      tp = &list->item[0].tokens[0];
+      if ((fs->for_pl == info->loop_line)
+	  && (fs->for_statement == info->loop_statement)
+	  && (fs->generation == program_generation)
+	  && ((list->num_items == 0)
+	      || ((tp[0] == IDENTIFIER) && (tp[1] == fs->var_index))))
+	{
+	  step_loop (fs);
+	  return;
+	}
+    }
+
   /* For compatibility, the variable is optional.
    * If omitted, use the top entry of the FOR stack. */
   if (list->num_items == 0)
@@ -834,9 +1367,8 @@ cmd_next (struct statement_header *stmt)
 int
 evaluate_next (const int var)
 {
+  struct for_stack_s *fs;
   struct statement_header *for_stmt;
-  unsigned short *tp;
-  double to_value, step_value;
   int i;
 
   /* Search the FOR...NEXT stack for the variable. */
@@ -857,10 +1389,18 @@ evaluate_next (const int var)
       for_stack_size = i + 1;
     }
 
-  /* Check the original FOR statement that started this loop. */
-  for_stmt = find_line_statement (for_stack[for_stack_size-1].for_line,
-				  for_stack[for_stack_size-1].for_statement);
-  if (for_stmt != for_stack[for_stack_size-1].for_stmt)
+  /* Check the original FOR statement that started this loop.
+   * If the program has changed, we have to look it up again. */
+  fs = &for_stack[for_stack_size-1];
+  if (fs->generation != program_generation)
+    {
+      fs->for_pl = saved_line (fs->for_line, 0);
+      fs->generation = program_generation;
+    }
+  for_stmt = ((fs->for_pl != NULL)
+	      && (fs->for_statement < fs->for_pl->num_statements))
+    ? fs->for_pl->statement[fs->for_statement].stmt : NULL;
+  if (for_stmt != fs->for_stmt)
     {
       printf ("ERROR - NEXT: LOST FOR %s\n", name_table[var]->contents);
       /* Pop the FOR...NEXT stack */
@@ -869,18 +1409,41 @@ evaluate_next (const int var)
       return -1;
     }
 
-  /* Evaluate the TO end of the statement */
-  tp = for_stack[for_stack_size-1].to_expr;
-  to_value = eval_number (&tp);
+  return step_loop (fs);
+}
 
-  if (for_stack[for_stack_size-1].step_expr != NULL)
+/* Increment the variable of the innermost FOR loop, and either go back
+ * to the start of the loop or pop it off the stack.  Returns 1 if we
+ * looped back to the statement following the FOR, 0 if we dropped out
+ * of the loop. */
+static int
+step_loop (struct for_stack_s *fs)
+{
+  unsigned short *tp;
+  double to_value, step_value;
+  int var = fs->var_index;
+
+  if (fixed_loop_limits)
     {
-      /* Evaluate the STEP */
-      tp = for_stack[for_stack_size-1].step_expr;
-      step_value = eval_number (&tp);
-    } else {
-      /* The default step is always 1; some programs depend on this. */
-      step_value = 1.0;
+      /* Use the values which FOR computed */
+      to_value = fs->to_value;
+      step_value = fs->step_value;
+    }
+  else
+    {
+      /* Evaluate the TO end of the statement */
+      tp = fs->to_expr;
+      to_value = eval_number (&tp);
+
+      if (fs->step_expr != NULL)
+	{
+	  /* Evaluate the STEP */
+	  tp = fs->step_expr;
+	  step_value = eval_number (&tp);
+	} else {
+	  /* The default step is always 1; some programs depend on this. */
+	  step_value = 1.0;
+	}
     }
 
   /* Increment the iteration variable */
@@ -893,8 +1456,7 @@ evaluate_next (const int var)
       : (variable_values[var].num >= to_value))
     {
       /* Return to the statement following the FOR statement */
-      current_line = for_stack[for_stack_size-1].for_line;
-      current_statement = for_stack[for_stack_size-1].for_statement + 1;
+      set_position (fs->for_pl, fs->for_statement + 1);
       return 1;
     } else {
       /* The loop has finished.  Pop the FOR...NEXT stack. */
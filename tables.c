@@ -1,8 +1,17 @@
+#ifdef __linux__
+#define _GNU_SOURCE		/* For mremap */
+#endif
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "tables.h"
 #include "basic.tab.h"
 
@@ -16,9 +25,257 @@ struct string_value **name_table = NULL;
 /* There is one variable for each name defined. */
 var_u *variable_values = NULL;
 
+/* Number of entries allocated in both of the above tables */
+static int name_table_allocated = 0;
+
+/* Hash index of the name table, using open addressing with linear
+ * probing.  Each slot holds a name's index plus 1, or 0 if empty. */
+static unsigned short *name_hash = NULL;
+static unsigned long name_hash_size = 0;	/* Always a power of 2 */
+
 /* The function table. */
 int function_table_size = 0;	/* Number of functions defined	*/
 struct fndef *function_table = NULL;
+/* Incremented every time a function or array is defined,
+ * so compiled code which depends on the table can be redone. */
+unsigned long function_generation = 0;
+
+/* The most memory all arrays together may take up, or 0 for no limit,
+ * and how much they take up now */
+unsigned long array_memory_limit = 4096UL << 20;
+static unsigned long array_memory = 0;
+
+/* Arrays at least this big are mapped straight from the system
+ * rather than allocated, so pages which are never written to
+ * take up no memory; the elements all start out as zero bytes. */
+#define MMAP_THRESHOLD (1 << 20)
+
+/* Allocate the (zeroed) storage for an array */
+static void *
+alloc_array (size_t bytes)
+{
+  void *data;
+
+  if (bytes < MMAP_THRESHOLD)
+    return calloc (1, bytes);
+  data = mmap (NULL, bytes, PROT_READ | PROT_WRITE,
+	       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  return (data == MAP_FAILED) ? NULL : data;
+}
+
+/* Free the storage for an array, which must be the same size
+ * as when it was allocated */
+static void
+free_array (void *data, size_t bytes)
+{
+  if (bytes < MMAP_THRESHOLD)
+    free (data);
+  else
+    munmap (data, bytes);
+}
+
+/* Change the size of the storage for an array, keeping its contents;
+ * any new bytes are zero.  Returns the storage, which may have moved,
+ * or NULL (leaving the old storage alone) if it can't be resized. */
+static void *
+resize_array (void *data, size_t old_bytes, size_t new_bytes)
+{
+  void *new_data;
+
+#ifdef MREMAP_MAYMOVE
+  /* A mapped array can be remapped without copying its pages */
+  if ((old_bytes >= MMAP_THRESHOLD) && (new_bytes >= MMAP_THRESHOLD))
+    {
+      new_data = mremap (data, old_bytes, new_bytes, MREMAP_MAYMOVE);
+      return (new_data == MAP_FAILED) ? NULL : new_data;
+    }
+#endif
+  new_data = alloc_array (new_bytes);
+  if (new_data == NULL)
+    return NULL;
+  memcpy (new_data, data, (old_bytes < new_bytes) ? old_bytes : new_bytes);
+  free_array (data, old_bytes);
+  return new_data;
+}
+
+/* An array kept in a file (DIM A(N) FILE "name") starts with this
+ * header, and its elements follow the dimensions, in the machine's
+ * own byte order.  The file is mapped as the array's storage. */
+struct array_file_header {
+  char magic[8];		/* ARRAY_FILE_MAGIC		*/
+  unsigned short element_size;	/* sizeof (double)		*/
+  char type;			/* 0 for a numeric array	*/
+  unsigned char num_dimensions;
+  unsigned int reserved;
+  unsigned long dimension[0];	/* The size of each dimension	*/
+};
+
+#define ARRAY_FILE_MAGIC "BASICARR"
+
+/* The bytes taken up by the header of an array file */
+#define ARRAY_FILE_HEADER(num_dimensions) \
+  (sizeof (struct array_file_header) \
+   + (num_dimensions) * sizeof (unsigned long))
+
+/* A string array keeps its elements one after another in a single
+ * block, in the same form as strings in the token stream (so they
+ * are used in place and copied if kept), with a table of where each
+ * one starts.  Unassigned elements all use the empty string at the
+ * start of the block.  Replacing an element leaves its old contents
+ * behind as garbage, which is squeezed out once there is enough. */
+struct string_array {
+  char *strings;		/* The elements			*/
+  size_t size;			/* Bytes allocated for them	*/
+  size_t used;			/* Bytes in use, including garbage */
+  size_t garbage;		/* Bytes of replaced elements	*/
+  unsigned long offset[0];	/* Where each element starts	*/
+};
+
+/* The bytes an element of the given length takes up */
+#define ELEMENT_SIZE(length) \
+  WALIGN (sizeof (struct string_value) + (length) + 1)
+
+/* The smallest block of elements */
+#define MIN_STRING_BLOCK 256
+
+/* The bytes taken up by the elements (or for a string array,
+ * the table of elements) of an array of the given type and size */
+#define ARRAY_BYTES(type, size) ((type) == '$' \
+  ? sizeof (struct string_array) + (size) * sizeof (unsigned long) \
+  : (size) * sizeof (double))
+
+/* Create the storage for a string array of the given size */
+static struct string_array *
+new_string_array (unsigned long size)
+{
+  struct string_array *array;
+  struct string_value *empty;
+
+  array = (struct string_array *) alloc_array (ARRAY_BYTES ('$', size));
+  if (array == NULL)
+    return NULL;
+  array->size = MIN_STRING_BLOCK;
+  array->strings = (char *) calloc (1, array->size);
+  if (array->strings == NULL)
+    {
+      free_array (array, ARRAY_BYTES ('$', size));
+      return NULL;
+    }
+  empty = (struct string_value *) array->strings;
+  empty->refs = STATIC_STRING;
+  array->used = ELEMENT_SIZE (0);
+  return array;
+}
+
+/* Return an element of a string array, which stays where it is
+ * until another element of the array is assigned */
+static inline struct string_value *
+string_element (struct fndef *array, unsigned long index)
+{
+  struct string_array *sa = (struct string_array *) array->array_data;
+  return (struct string_value *) &sa->strings[sa->offset[index]];
+}
+
+/* Copy the elements of a string array into a new block of the given
+ * size in index order, leaving out the garbage */
+static void
+compact_string_array (struct fndef *array, size_t size)
+{
+  struct string_array *sa = (struct string_array *) array->array_data;
+  struct string_value *element;
+  char *strings;
+  size_t used, length;
+  unsigned long i;
+
+  strings = (char *) malloc (size);
+  used = ELEMENT_SIZE (0);
+  memcpy (strings, sa->strings, used);
+  for (i = 0; i < array->array_size; i++)
+    {
+      if (sa->offset[i] == 0)
+	continue;
+      element = (struct string_value *) &sa->strings[sa->offset[i]];
+      length = ELEMENT_SIZE (element->length);
+      memcpy (&strings[used], element, length);
+      sa->offset[i] = used;
+      used += length;
+    }
+  free (sa->strings);
+  sa->strings = strings;
+  sa->size = size;
+  sa->used = used;
+  sa->garbage = 0;
+}
+
+/* Assign a copy of a string to an element of a string array */
+static void
+store_string_element (struct fndef *array, unsigned long index,
+		      struct string_value *value)
+{
+  struct string_array *sa = (struct string_array *) array->array_data;
+  struct string_value *element;
+  size_t length = ELEMENT_SIZE (value->length), old_length = 0, size;
+
+  /* The value may be another element, which could move */
+  if (((char *) value >= sa->strings)
+      && ((char *) value < &sa->strings[sa->used]))
+    value = new_string (value->contents, value->length);
+
+  if (sa->offset[index] != 0)
+    {
+      element = string_element (array, index);
+      old_length = ELEMENT_SIZE (element->length);
+      if (length <= old_length)
+	{
+	  /* The new value fits where the old one was */
+	  memcpy (element->contents, value->contents, value->length);
+	  memset (&element->contents[value->length], 0,
+		  length - value->length - sizeof (struct string_value));
+	  element->length = value->length;
+	  sa->garbage += old_length - length;
+	  return;
+	}
+    }
+  /* Otherwise the old value is garbage */
+  sa->offset[index] = 0;
+  sa->garbage += old_length;
+  if (value->length == 0)
+    return;
+
+  if (sa->used + length > sa->size)
+    {
+      /* Make room for the element, squeezing out the garbage
+       * if it takes up half of the block */
+      if (sa->garbage >= sa->used / 2)
+	{
+	  size = sa->size;
+	  while ((size > MIN_STRING_BLOCK)
+		 && (sa->used - sa->garbage + length <= size / 4))
+	    size /= 2;
+	  while (sa->used - sa->garbage + length > size)
+	    size *= 2;
+	  compact_string_array (array, size);
+	}
+      else
+	{
+	  size = sa->size;
+	  while (sa->used + length > size)
+	    size *= 2;
+	  sa->strings = (char *) realloc (sa->strings, size);
+	  sa->size = size;
+	}
+    }
+
+  element = (struct string_value *) &sa->strings[sa->used];
+  element->refs = STATIC_STRING;
+  element->length = value->length;
+  element->capacity = 0;
+  memcpy (element->contents, value->contents, value->length);
+  memset (&element->contents[value->length], 0,
+	  length - value->length - sizeof (struct string_value));
+  sa->offset[index] = sa->used;
+  sa->used += length;
+}
 
 
 /* Free the memory used by a function or array */
@@ -40,9 +297,26 @@ free_function (struct fndef *fn)
       free (fn->array_dimension);
       fn->array_dimension = NULL;
     }
+  if (fn->array_stride != NULL)
+    {
+      free (fn->array_stride);
+      fn->array_stride = NULL;
+    }
+  if ((fn->array_data != NULL) && fn->array_file)
+    {
+      /* The elements already are the file's contents */
+      munmap ((char *) fn->array_data - ARRAY_FILE_HEADER (fn->num_args),
+	      ARRAY_FILE_HEADER (fn->num_args)
+	      + fn->array_size * sizeof (double));
+      fn->array_data = NULL;
+      fn->array_file = 0;
+    }
   if (fn->array_data != NULL)
     {
-      free (fn->array_data);
+      if (fn->type == '$')
+	free (((struct string_array *) fn->array_data)->strings);
+      free_array (fn->array_data, ARRAY_BYTES (fn->type, fn->array_size));
+      array_memory -= ARRAY_BYTES (fn->type, fn->array_size);
       fn->array_data = NULL;
     }
 }
@@ -56,40 +330,92 @@ initialize_tables (void)
 
   for (i = 0; i < name_table_size; i++)
     {
-      if ((name_table[i]->contents[name_table[i]->length - 1] == '$')
-	  && (variable_values[i].str != NULL))
-	free (variable_values[i].str);
+      if (name_table[i]->contents[name_table[i]->length - 1] == '$')
+	release_string (variable_values[i].str);
       free (name_table[i]);
     }
   name_table_size = 0;
+  if (name_hash != NULL)
+    memset (name_hash, 0, sizeof (unsigned short) * name_hash_size);
 
   for (i = 0; i < function_table_size; i++)
     free_function (&function_table[i]);
   function_table_size = 0;
 
-  for (i = 0; i < program_size; i++)
-    free (program[i]);
-  program_size = 0;
+  clear_program ();
 
   initialize_builtin_functions ();
 }
 
+/* Case-insensitive hash of a name (FNV-1a) */
+static unsigned long
+hash_name (const char *name)
+{
+  unsigned long hash = 2166136261UL;
+
+  while (*name)
+    {
+      hash ^= (unsigned char) toupper ((unsigned char) *name++);
+      hash *= 16777619UL;
+    }
+  return hash;
+}
+
+/* Find the slot in the hash index for a name,
+ * or the empty slot where it should go */
+static unsigned short *
+name_slot (const char *name)
+{
+  unsigned long i;
+
+  for (i = hash_name (name) & (name_hash_size - 1); name_hash[i] != 0;
+       i = (i + 1) & (name_hash_size - 1))
+    if (strcasecmp (name, name_table[name_hash[i] - 1]->contents) == 0)
+      break;
+  return &name_hash[i];
+}
+
 /* This function returns the index of a variable name in the name table.
- * If the name does not already exist, it is added. */
-unsigned short
+ * If the name does not already exist, it is added.  Returns -1 if
+ * the table is full, leaving it as it was. */
+int
 find_var_name (const char *name)
 {
+  unsigned short *slot;
   int i, len;
 
-  for (i = 0; i < name_table_size; i++)
+  /* Keep the hash index no more than half full */
+  if (2 * (name_table_size + 1) > name_hash_size)
     {
-      if (strcasecmp (name, name_table[i]->contents) == 0)
-	return i;
+      free (name_hash);
+      name_hash_size = name_hash_size ? (name_hash_size * 2) : 256;
+      name_hash = (unsigned short *) calloc
+	(name_hash_size, sizeof (unsigned short));
+      for (i = 0; i < name_table_size; i++)
+	*name_slot (name_table[i]->contents) = i + 1;
     }
 
+  slot = name_slot (name);
+  if (*slot != 0)
+    return *slot - 1;
+
   /* Name not found; add it to the table */
-  name_table = (struct string_value **) realloc
-    (name_table, sizeof (struct string_value *) * ++name_table_size);
+  if (name_table_size >= USHRT_MAX)
+    {
+      puts ("ERROR - TOO MANY VARIABLE NAMES");
+      return -1;
+    }
+  i = name_table_size++;
+  if (name_table_size > name_table_allocated)
+    {
+      name_table_allocated = name_table_allocated
+	? (name_table_allocated * 2) : 256;
+      name_table = (struct string_value **) realloc
+	(name_table, sizeof (struct string_value *) * name_table_allocated);
+      variable_values = (var_u *) realloc
+	(variable_values, sizeof (var_u) * name_table_allocated);
+    }
+  *slot = i + 1;
   len = strlen (name);
   name_table[i] = (struct string_value *) calloc
     (1, WALIGN (sizeof (struct string_value) + len + 1));
@@ -98,8 +424,6 @@ find_var_name (const char *name)
   memcpy (name_table[i]->contents, name, len);
 
   /* Add to the variable arrays */
-  variable_values = (var_u *) realloc
-    (variable_values, sizeof (var_u) * (i + 1));
   if (name[len - 1] == '$')
     variable_values[i].str = NULL;
   else
@@ -109,18 +433,71 @@ find_var_name (const char *name)
 }
 
 
+/* Index of each name's entry in the function table (or -1),
+ * rebuilt whenever the function table changes */
+static int *function_slot = NULL;
+static int function_slot_size = 0;
+static unsigned long function_slot_generation;
+
 /* Common routine to map an identifier to a function table entry */
-static struct fndef *
+struct fndef *
 find_function (unsigned short id)
 {
   int i;
 
-  for (i = 0; i < function_table_size; i++)
+  if ((function_slot == NULL)
+      || (function_slot_generation != function_generation)
+      || (function_slot_size < name_table_size))
     {
-      if (function_table[i].name_index == id)
-	return &function_table[i];
+      if (function_slot_size < name_table_allocated)
+	{
+	  function_slot_size = name_table_allocated;
+	  function_slot = (int *) realloc
+	    (function_slot, sizeof (int) * function_slot_size);
+	}
+      for (i = 0; i < function_slot_size; i++)
+	function_slot[i] = -1;
+      for (i = 0; i < function_table_size; i++)
+	function_slot[function_table[i].name_index] = i;
+      function_slot_generation = function_generation;
     }
-  return NULL;
+
+  if ((id >= function_slot_size) || (function_slot[id] < 0))
+    return NULL;
+  return &function_table[function_slot[id]];
+}
+
+/* Store the value of an index (or dimension) in the list of
+ * indices, if it is in range.  Returns 0 if successful,
+ * or -1 if an error occurred. */
+static int
+set_index (unsigned long *indices, int i, int nargs, double d,
+	   int dim_or_index)
+{
+  if (tracing & TRACE_EXPRESSIONS) // FIXME: Changed from 4 (set by cmd_let)
+    {
+      fprintf (stderr, "%g", d);
+      if (i < nargs - 1)
+	fputc (',', stderr);
+    }
+  /* Is this a valid index? */
+  if (!(d >= 0.0) || (d >= (double) ULONG_MAX))
+    {
+      if (current_line == (unsigned long) -1)
+	printf ((dim_or_index == DIM)
+		? "ERROR - DIMENSION #%d OUT OF RANGE\n"
+		: "ERROR - INDEX #%d OUT OF RANGE\n", i + 1);
+      else
+	printf ((dim_or_index == DIM)
+		? "ERROR - DIMENSION #%d OUT OF RANGE ON LINE %d\n"
+		: "ERROR - INDEX #%d OUT OF RANGE ON LINE %d\n",
+		i + 1, current_line);
+      executing = 0;
+      current_column = 0;
+      return -1;
+    }
+  indices[i] = (unsigned long) d;
+  return 0;
 }
 
 /* Common routine to evaluate a list of indices.
@@ -128,8 +505,8 @@ find_function (unsigned short id)
  * the evaluated values will be stored in `indices'.
  * Returns 0 if all indices were evaluated successfully,
  * or -1 if an error occurred. */
-static int
-get_indices (struct list_header *index_list, unsigned short *indices,
+int
+get_indices (struct list_header *index_list, unsigned long *indices,
 	     int nargs, int dim_or_index)
 {
   int i;
@@ -165,29 +542,8 @@ get_indices (struct list_header *index_list, unsigned short *indices,
 	  return -1;
 	}
       d = eval_number (&tp);
-      if (tracing & TRACE_EXPRESSIONS) // FIXME: Changed from 4 (set by cmd_let)
-	{
-	  fprintf (stderr, "%g", d);
-	  if (i < nargs - 1)
-	    fputc (',', stderr);
-	}
-      /* Is this a valid index? */
-      if ((d < 0.0) || (d > (double) USHRT_MAX))
-	{
-	  if (current_line == (unsigned long) -1)
-	    printf ((dim_or_index == DIM)
-		    ? "ERROR - DIMENSION #%d OUT OF RANGE\n"
-		    : "ERROR - INDEX #%d OUT OF RANGE\n", i + 1);
-	  else
-	    printf ((dim_or_index == DIM)
-		    ? "ERROR - DIMENSION #%d OUT OF RANGE ON LINE %d\n"
-		    : "ERROR - INDEX #%d OUT OF RANGE ON LINE %d\n",
-		    i + 1, current_line);
-	  executing = 0;
-	  current_column = 0;
-	  return -1;
-	}
-      indices[i] = (unsigned short) d;
+      if (set_index (indices, i, nargs, d, dim_or_index))
+	return -1;
       /* Skip the list delimiter (',') */
       tp = (unsigned short *) &((char *) lp)[lp->length];
       lp = (struct list_item *) &tp[1];
@@ -258,18 +614,100 @@ get_arguments (struct list_header *arg_list, var_u *args,
 }
 
 
+/* Map the elements of a numeric array from a file, creating the
+ * file if need be.  An existing file must hold an array of the same
+ * dimensions.  Returns the elements, or NULL on error. */
+static double *
+map_array_file (const char *filename, int num_dimensions,
+		const unsigned long *dim_size, unsigned long total_size)
+{
+  struct array_file_header *header;
+  struct stat st;
+  size_t header_size, file_size;
+  void *map;
+  int fd, i;
+
+  header_size = ARRAY_FILE_HEADER (num_dimensions);
+  file_size = header_size + total_size * sizeof (double);
+  fd = open (filename, O_RDWR | O_CREAT, 0666);
+  if ((fd < 0) || (fstat (fd, &st) < 0))
+    {
+      printf ("ERROR - DIM: %s: %s\n", filename, strerror (errno));
+      if (fd >= 0)
+	close (fd);
+      return NULL;
+    }
+
+  /* A new (empty) file is given a header, and
+   * its elements read as 0 until they are written. */
+  if ((st.st_size == 0) && (ftruncate (fd, file_size) < 0))
+    {
+      printf ("ERROR - DIM: %s: %s\n", filename, strerror (errno));
+      close (fd);
+      return NULL;
+    }
+  if ((st.st_size != 0) && ((size_t) st.st_size < header_size))
+    {
+      printf ("ERROR - DIM: %s IS NOT AN ARRAY FILE\n", filename);
+      close (fd);
+      return NULL;
+    }
+  map = mmap (NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+    {
+      printf ("ERROR - DIM: %s: %s\n", filename, strerror (errno));
+      return NULL;
+    }
+
+  header = (struct array_file_header *) map;
+  if (st.st_size == 0)
+    {
+      memcpy (header->magic, ARRAY_FILE_MAGIC, sizeof (header->magic));
+      header->element_size = sizeof (double);
+      header->type = 0;
+      header->num_dimensions = num_dimensions;
+      memcpy (header->dimension, dim_size,
+	      sizeof (unsigned long) * num_dimensions);
+      return (double *) ((char *) map + header_size);
+    }
+
+  /* Make sure the file holds the array we expect */
+  if ((memcmp (header->magic, ARRAY_FILE_MAGIC, sizeof (header->magic)) != 0)
+      || (header->element_size != sizeof (double)) || (header->type != 0))
+    {
+      printf ("ERROR - DIM: %s IS NOT AN ARRAY FILE\n", filename);
+      munmap (map, file_size);
+      return NULL;
+    }
+  for (i = 0; i < num_dimensions; i++)
+    if (header->dimension[i] != dim_size[i])
+      break;
+  if ((header->num_dimensions != num_dimensions) || (i < num_dimensions)
+      || ((size_t) st.st_size != file_size))
+    {
+      printf ("ERROR - DIM: %s HOLDS AN ARRAY OF DIFFERENT DIMENSIONS\n",
+	      filename);
+      munmap (map, file_size);
+      return NULL;
+    }
+  return (double *) ((char *) map + header_size);
+}
+
 /* Define a variable as an array.  The number of dimensions
- * and size of each dimension are given directly.
+ * and size of each dimension are given directly, along with
+ * the name of the file to keep it in, if any (otherwise NULL).
  * Returns the new array if it was successfully allocated
  * or NULL on error. */
 static struct fndef *
 _dim_internal (unsigned short id,
 	       int num_dimensions,
-	       const unsigned short *dim_size)
+	       const unsigned long *dim_size,
+	       const char *filename)
 {
   int i;
   struct fndef *array;
-  unsigned long total_size;
+  unsigned long total_size, max_size, max_bytes, header;
 
   /* If this variable is already being used, remove the current definition */
   array = find_function (id);
@@ -295,111 +733,300 @@ _dim_internal (unsigned short id,
 	? '$' : 0;
     }
 
+  function_generation++;
   array->num_args = num_dimensions;
+  /* The array may take up whatever memory the other arrays have
+   * left under the limit, unless it is kept in a file */
+  max_bytes = ULONG_MAX;
+  if (array_memory_limit && (filename == NULL))
+    max_bytes = (array_memory_limit > array_memory)
+      ? array_memory_limit - array_memory : 0;
+  header = ARRAY_BYTES (array->type, 0);
+  max_size = (max_bytes > header)
+    ? (max_bytes - header) / (ARRAY_BYTES (array->type, 1) - header) : 0;
   total_size = 1;
   for (i = 0; i < num_dimensions; i++)
     {
-      /* 1 million elements seems to be
-       * a reasonable maximum limit for BASIC data */
-      if (total_size >= (1 << 20) / ((unsigned int) dim_size[i] + 1))
+      /* The *real* dimension is d+1, since BASIC programs
+       * may start indices at 0 as well as 1. */
+      if (total_size > max_size / (dim_size[i] + 1))
 	{
 	  puts ("ERROR - DIM: ARRAY TOO BIG");
+	  array->array_size = 0;
 	  executing = 0;
 	  return NULL;
 	}
-      /* The *real* dimension is d+1, since BASIC programs
-       * may start indices at 0 as well as 1. */
-      total_size *= (unsigned int) dim_size[i] + 1;
+      total_size *= dim_size[i] + 1;
+    }
+
+  /* Allocate the array; its elements all start out as 0
+   * (or for a string array, the empty string) */
+  array->array_size = total_size;
+  if (filename != NULL)
+    {
+      array->array_data = map_array_file (filename, num_dimensions,
+					  dim_size, total_size);
+      if (array->array_data == NULL)
+	{
+	  array->array_size = 0;
+	  executing = 0;
+	  return NULL;
+	}
+      array->array_file = 1;
+    } else {
+      if (array->type == '$')
+	array->array_data = new_string_array (total_size);
+      else
+	array->array_data = alloc_array (total_size * sizeof (double));
+      if (array->array_data == NULL)
+	{
+	  puts ("ERROR - DIM: OUT OF MEMORY");
+	  array->array_size = 0;
+	  executing = 0;
+	  return NULL;
+	}
+      array_memory += ARRAY_BYTES (array->type, total_size);
     }
 
-  /* Allocate the array */
-  array->array_data = calloc (total_size,
-			      ((array->type == '$')
-			       ? sizeof (struct string_value *)
-			       : sizeof (double)));
-  if (array->array_data == NULL)
+  /* Copy the dimensions, and work out how far apart
+   * the elements are along each of them (row-major) */
+  array->array_dimension = (unsigned long *) malloc
+    (sizeof (unsigned long) * num_dimensions);
+  memcpy (array->array_dimension, dim_size,
+	  sizeof (unsigned long) * num_dimensions);
+  array->array_stride = (unsigned long *) malloc
+    (sizeof (unsigned long) * num_dimensions);
+  total_size = 1;
+  for (i = num_dimensions - 1; i >= 0; i--)
+    {
+      array->array_stride[i] = total_size;
+      total_size *= dim_size[i] + 1;
+    }
+  array->argtypes = 0;
+
+  return array;
+}
+
+/* Define a variable as an array, for MAT */
+struct fndef *
+dim_array (unsigned short id, int num_dimensions,
+	   const unsigned long *dim_size)
+{
+  return _dim_internal (id, num_dimensions, dim_size, NULL);
+}
+
+/* Clear an element of an array which has gone out of range */
+static void
+clear_element (struct fndef *array, unsigned long index)
+{
+  struct string_array *sa;
+
+  if (!array->type)
+    {
+      ((double *) array->array_data)[index] = 0.0;
+      return;
+    }
+  sa = (struct string_array *) array->array_data;
+  if (sa->offset[index] != 0)
+    {
+      sa->garbage += ELEMENT_SIZE (string_element (array, index)->length);
+      sa->offset[index] = 0;
+    }
+}
+
+/* Change the size of the last dimension of an array, keeping the
+ * elements which are still in range.  The rows along the last
+ * dimension are spaced out to allow room for them to grow, and the
+ * space doubles whenever they outgrow it, so that growing an array
+ * one element at a time only moves each element a few times.  If an
+ * array shrinks to a quarter of its space, the rest is given back.
+ * Anything which is not yet an array is defined as one.
+ * Returns the array if it was successfully resized or NULL on error. */
+static struct fndef *
+_redim_internal (unsigned short id,
+		 int num_dimensions,
+		 const unsigned long *dim_size)
+{
+  int i;
+  struct fndef *array;
+  unsigned long rows, r, j, old_length, new_length, old_space, new_space;
+  unsigned long max_size, max_bytes, others;
+  size_t header, element, old_bytes, new_bytes;
+  char *data;
+
+  array = find_function (id);
+  if ((array == NULL) || (array->array_dimension == NULL))
+    return _dim_internal (id, num_dimensions, dim_size, NULL);
+  if (array->array_file)
     {
-      puts ("ERROR - DIM: OUT OF MEMORY");
+      printf ("ERROR - REDIM: %s IS KEPT IN A FILE\n",
+	      name_table[array->name_index]->contents);
       executing = 0;
       return NULL;
     }
-  /* If this is a numeric array, initialize the elements to 0.0 */
-  if (!array->type)
+  for (i = 0; i < num_dimensions - 1; i++)
+    if (dim_size[i] != array->array_dimension[i])
+      break;
+  if ((num_dimensions != array->num_args) || (i < num_dimensions - 1))
     {
-      double *dp = (double *) array->array_data;
-      while (total_size--)
-	*dp++ = 0.0;
+      printf ("ERROR - REDIM: ONLY THE LAST DIMENSION OF %s MAY CHANGE\n",
+	      name_table[array->name_index]->contents);
+      executing = 0;
+      return NULL;
     }
 
-  /* Copy the dimensions */
-  array->array_dimension = (unsigned short *) malloc
-    (sizeof (short) * num_dimensions);
-  memcpy (array->array_dimension, dim_size, sizeof (short) * num_dimensions);
-  array->argtypes = 0;
+  header = ARRAY_BYTES (array->type, 0);
+  element = ARRAY_BYTES (array->type, 1) - header;
+  old_length = array->array_dimension[num_dimensions - 1] + 1;
+  new_length = dim_size[num_dimensions - 1] + 1;
+  old_space = (num_dimensions > 1)
+    ? array->array_stride[num_dimensions - 2] : array->array_size;
+  rows = array->array_size / old_space;
+
+  /* Clear the elements being dropped, so that they
+   * start out as 0 again if the array grows back */
+  for (r = 0; r < rows; r++)
+    for (j = new_length; j < old_length; j++)
+      clear_element (array, r * old_space + j);
+
+  new_space = old_space;
+  if (new_length > old_space)
+    new_space = (new_length > 2 * old_space) ? new_length : 2 * old_space;
+  else if (new_length <= old_space / 4)
+    new_space = 2 * new_length;
+  if (new_space != old_space)
+    {
+      /* The array may take up whatever memory
+       * the other arrays have left under the limit */
+      old_bytes = ARRAY_BYTES (array->type, array->array_size);
+      others = array_memory - old_bytes;
+      max_bytes = ULONG_MAX;
+      if (array_memory_limit)
+	max_bytes = (array_memory_limit > others)
+	  ? array_memory_limit - others : 0;
+      max_size = (max_bytes > header) ? (max_bytes - header) / element : 0;
+      if (new_length > max_size / rows)
+	{
+	  puts ("ERROR - REDIM: ARRAY TOO BIG");
+	  executing = 0;
+	  return NULL;
+	}
+      if (new_space > max_size / rows)
+	new_space = new_length;
+      new_bytes = ARRAY_BYTES (array->type, rows * new_space);
 
+      if (rows == 1)
+	data = (char *) resize_array (array->array_data, old_bytes, new_bytes);
+      else
+	{
+	  /* Copy each row to its new place */
+	  data = (char *) alloc_array (new_bytes);
+	  if (data != NULL)
+	    {
+	      memcpy (data, array->array_data, header);
+	      for (r = 0; r < rows; r++)
+		memcpy (&data[header + r * new_space * element],
+			&((char *) array->array_data)
+			[header + r * old_space * element],
+			((old_space < new_space) ? old_space : new_space)
+			* element);
+	      free_array (array->array_data, old_bytes);
+	    }
+	}
+
+      if (data != NULL)
+	{
+	  array->array_data = data;
+	  array->array_size = rows * new_space;
+	  array_memory = others + new_bytes;
+	}
+      else if (new_space > old_space)
+	{
+	  puts ("ERROR - REDIM: OUT OF MEMORY");
+	  executing = 0;
+	  return NULL;
+	}
+      else
+	/* Keep the space we have */
+	new_space = old_space;
+    }
+
+  /* Work out the new distances between elements */
+  array->array_dimension[num_dimensions - 1] = new_length - 1;
+  r = new_space;
+  for (i = num_dimensions - 2; i >= 0; i--)
+    {
+      array->array_stride[i] = r;
+      r *= array->array_dimension[i] + 1;
+    }
   return array;
 }
 
-/* Define a variable as an array.  The sizes are
- * given in a list of tokens to be evaluated. */
+/* Define (or with REDIM PRESERVE, resize) a variable as an array.
+ * The sizes are given in a list of tokens to be evaluated. */
 static void
-dim (unsigned short id, struct list_header *size_list)
+dim (unsigned short id, struct list_header *size_list,
+     const char *filename, int preserve)
 {
-  int dimensions;
-  // struct fndef *array;
-  // struct list_item *lp;
-  // unsigned short *tp;
-  unsigned short dimension[32];
-  // double d;
+  unsigned long dimension[32];
 
   /* Get the dimensions of the array */
-  dimensions = size_list->num_items;
   if (get_indices (size_list, dimension, size_list->num_items, DIM))
     return;
 
-  _dim_internal (id, size_list->num_items, dimension);
+  if (preserve)
+    _redim_internal (id, size_list->num_items, dimension);
+  else
+    _dim_internal (id, size_list->num_items, dimension, filename);
 }
 
 
 /* All array lookups use the same algorithm to find the item;
  * only the item size and return values are different. */
 static unsigned long
-array_lookup (struct fndef *array, unsigned short *index_list)
+array_lookup (struct fndef *array, unsigned long *index_list)
 {
   int i, num_items = array->num_args;
   unsigned long total_index;
-  double d;
+  int out_of_range;
 
-  /* Get the indices */
-  total_index = 0;
-  for (i = 0; i < num_items; i++)
+  if (num_items == 1)
     {
-      if (index_list[i] > array->array_dimension[i])
+      /* Check the only index */
+      if (index_list[0] <= array->array_dimension[0])
+	return index_list[0];
+    } else {
+      /* Check all of the indices at once */
+      total_index = 0;
+      out_of_range = 0;
+      for (i = 0; i < num_items; i++)
 	{
-	  if (current_line == (unsigned long) -1)
-	    printf ("ERROR - INDEX #%d OUT OF RANGE\n", i + 1);
-	  else
-	    printf ("ERROR - INDEX #%d OUT OF RANGE ON LINE %d\n",
-		    i + 1, current_line);
-	  current_column = 0;
-	  executing = 0;
-	  return -1;
+	  out_of_range |= (index_list[i] > array->array_dimension[i]);
+	  total_index += index_list[i] * array->array_stride[i];
 	}
-      total_index = ((total_index
-		      /* The *real* dimension is d+1, since BASIC programs
-		       * may start indices at 0 as well as 1. */
-		      * ((unsigned int) array->array_dimension[i] + 1))
-		     + (unsigned int) index_list[i]);
+      /* We have the index; that's all we need here. */
+      if (!out_of_range)
+	return total_index;
     }
 
-  /* We have the index; that's all we need here. */
-  return total_index;
+  /* Find out which index was bad */
+  for (i = 0; i < num_items - 1; i++)
+    if (index_list[i] > array->array_dimension[i])
+      break;
+  if (current_line == (unsigned long) -1)
+    printf ("ERROR - INDEX #%d OUT OF RANGE\n", i + 1);
+  else
+    printf ("ERROR - INDEX #%d OUT OF RANGE ON LINE %d\n",
+	    i + 1, current_line);
+  current_column = 0;
+  executing = 0;
+  return -1;
 }
 
 /* List of dimensions used for default array initialization.
- * We support a maximum of 1 million entries (technically 1,048,576)
- * which means we can only have 5 dimensions of the default size. */
-const unsigned short SIZE_TEN[10] = {
+ * Eight dimensions of the default size come to 214 million
+ * entries, which is as many as the default memory limit allows. */
+const unsigned long SIZE_TEN[10] = {
   10, 10, 10, 10, 10, 10, 10, 10
 };
 
@@ -407,7 +1034,7 @@ double *
 num_array_lookup (unsigned short id, struct list_header *index_list)
 {
   struct fndef *array;
-  unsigned short indices[32];
+  unsigned long indices[32];
   unsigned long index;
 
   /* Find the array element */
@@ -416,7 +1043,7 @@ num_array_lookup (unsigned short id, struct list_header *index_list)
     {
       /* The original BASIC allowed undimensioned arrays
        * with a default size of 10 */
-      array = _dim_internal (id, index_list->num_items, SIZE_TEN);
+      array = _dim_internal (id, index_list->num_items, SIZE_TEN, NULL);
       if (array == NULL)
 	return NULL;
     }
@@ -436,12 +1063,13 @@ num_array_lookup (unsigned short id, struct list_header *index_list)
   return &((double *) array->array_data)[index];
 }
 
-struct string_value **
+/* Find an element of a string array for assignment by set_str_array().
+ * Returns its index, or -1 if there is no such element. */
+long
 str_array_lookup (unsigned short id, struct list_header *index_list)
 {
   struct fndef *array;
-  unsigned short indices[32];
-  unsigned long index;
+  unsigned long indices[32];
 
   /* Find the array element */
   array = find_function (id);
@@ -449,45 +1077,54 @@ str_array_lookup (unsigned short id, struct list_header *index_list)
     {
       /* The original BASIC allowed undimensioned arrays
        * with a default size of 10 */
-      array = _dim_internal (id, index_list->num_items, SIZE_TEN);
+      array = _dim_internal (id, index_list->num_items, SIZE_TEN, NULL);
       if (array == NULL)
-	return NULL;
+	return -1;
     }
   if (array->type != '$')
     {
       fprintf (stderr, "str_array_lookup: %s is a numeric array\n",
 	       name_table[id]->contents);
-      return NULL;
+      return -1;
     }
   if (get_indices (index_list, indices, array->num_args, 0))
-    return NULL;
-  index = array_lookup (array, indices);
-  if (index == (unsigned long) -1)
-    return NULL;
+    return -1;
+  return (long) array_lookup (array, indices);
+}
 
-  /* Return the reference to the correct string pointer */
-  return &((struct string_value **) array->array_data)[index];
+/* Assign a copy of a string to an element of a string array found by
+ * str_array_lookup().  The array is looked up again, since evaluating
+ * the value may have defined other arrays. */
+void
+set_str_array (unsigned short id, long index, struct string_value *value)
+{
+  struct fndef *array = find_function (id);
+
+  if ((array == NULL) || (array->type != '$') || (array->array_data == NULL)
+      || (index < 0) || ((unsigned long) index >= array->array_size))
+    return;
+  store_string_element (array, index, value);
 }
 
 
+static var_u call_fn_or_array (struct fndef *fn_or_array,
+			       struct list_header *arg_list, var_u *args);
+
 /* Evaluate a numeric or string function or find an array element.
  * We won't know which it is until we look up the identifier. */
 var_u
 eval_fn_or_array (unsigned short id, struct list_header *arg_list)
 {
-  int i, arg_id;
-  struct list_item *lp;
-  unsigned short *tp;
   struct fndef *fn_or_array;
-  var_u args[32], saved_vars[32], result;
-  unsigned long arg_types = 0;
+  struct scratch_mark mark;
+  var_u args[32], result;
 
   fn_or_array = find_function (id);
   if (fn_or_array == NULL)
     {
       /* The original BASIC allowed undimensioned
        * arrays with a default size of 10 */
-      fn_or_array = _dim_internal (id, arg_list->num_items, SIZE_TEN);
+      fn_or_array = _dim_internal (id, arg_list->num_items, SIZE_TEN, NULL);
       if (fn_or_array == NULL) {
 	fprintf (stderr,
 		 "eval_fn_or_array(): called for %s, which is not in the function table\n",
@@ -496,23 +1133,124 @@ eval_fn_or_array (unsigned short id, struct list_header *arg_list)
       }
     }
 
+  /* String arguments to a numeric function (such as LEN) are
+   * finished with once it returns. */
+  mark_scratch (&mark);
+
   /* Get the arguments */
   if (get_arguments (arg_list, args,
 		     fn_or_array->num_args, fn_or_array->argtypes))
     return ((fn_or_array->type == '$')
 	    ? (var_u) (struct string_value *) NULL : (var_u) 0.0);
 
+  result = call_fn_or_array (fn_or_array, arg_list, args);
+  if (fn_or_array->argtypes && (fn_or_array->type != '$'))
+    release_scratch (&mark);
+  return result;
+}
+
+/* Evaluate a function call or array reference which has been bound
+ * to the function table entry at index `slot' by check_arguments().
+ * The token pointer is at the identifier. */
+var_u
+eval_bound_function (unsigned long slot, unsigned short *tp)
+{
+  struct fndef *fn = &function_table[slot];
+  struct list_header *arg_list = (struct list_header *) &tp[4];
+  struct list_item *lp;
+  struct scratch_mark mark;
+  var_u args[32], result;
+  int i;
+
+  /* The argument types have already been checked */
+  mark_scratch (&mark);
+  lp = &arg_list->item[0];
+  for (i = 0; i < fn->num_args; i++)
+    {
+      tp = &lp->tokens[0];
+      if (fn->argtypes & (1 << i))
+	args[i].str = eval_string (&tp);
+      else
+	args[i].num = eval_number (&tp);
+      /* Skip the argument delimiter (',') */
+      tp = (unsigned short *) &((char *) lp)[lp->length];
+      lp = (struct list_item *) &tp[1];
+    }
+
+  result = call_fn_or_array (fn, arg_list, args);
+  if (fn->argtypes && (fn->type != '$'))
+    release_scratch (&mark);
+  return result;
+}
+
+/* Check whether the arguments of a function call or array reference
+ * match the function.  Returns 0 if they do, so the call site can
+ * skip looking up the function and checking the arguments each time
+ * it's evaluated, or -1 if the call has to be left to
+ * eval_fn_or_array() (which also reports any error). */
+int
+check_arguments (struct fndef *fn, struct list_header *arg_list)
+{
+  struct list_item *lp;
+  unsigned short *tp;
+  int i;
+
+  if ((fn == NULL) || (fn->num_args != arg_list->num_items)
+      || (fn->num_args > 32))
+    return -1;
+  lp = &arg_list->item[0];
+  for (i = 0; i < fn->num_args; i++)
+    {
+      tp = &lp->tokens[0];
+      switch (*tp)
+	{
+	case IDENTIFIER:
+	case INTEGER:
+	case FLOATINGPOINT:
+	case NUMEXPR:
+	  if (fn->argtypes & (1 << i))
+	    return -1;
+	  break;
+
+	case STRING:
+	case STRINGIDENTIFIER:
+	case STREXPR:
+	  if (!(fn->argtypes & (1 << i)))
+	    return -1;
+	  break;
+
+	default:
+	  return -1;
+	}
+      /* Skip the argument delimiter (',') */
+      tp = (unsigned short *) &((char *) lp)[lp->length];
+      lp = (struct list_item *) &tp[1];
+    }
+  return 0;
+}
+
+/* Call a function or look up an array element,
+ * once the arguments have been evaluated */
+static var_u
+call_fn_or_array (struct fndef *fn_or_array, struct list_header *arg_list,
+		  var_u *args)
+{
+  int i, arg_id;
+  unsigned short *tp;
+  unsigned short id = fn_or_array->name_index;
+  var_u saved_vars[32], result;
+
   /* Call the appropriate subroutine depending on whether this is
    * a built-in function, user-defined function, or array */
   if (fn_or_array->built_in != NULL)
     {
       /* Compute the result */
       result = fn_or_array->built_in (args);
-      /* Free any string arguments */
+      /* Release any string arguments */
       for (i = 0; i < fn_or_array->num_args; i++)
 	{
 	  if (fn_or_array->argtypes & (1 << i))
-	    free (args[i].str);
+	    release_string (args[i].str);
 	}
       return result;
     }
@@ -560,7 +1298,10 @@ eval_fn_or_array (unsigned short id, struct list_header *arg_list)
 	{
 	  arg_id = fn_or_array->arg_ids[i];
 	  if (fn_or_array->argtypes & (1 << i))
-	    variable_values[arg_id].str = saved_vars[i].str;
+	    {
+	      release_string (variable_values[arg_id].str);
+	      variable_values[arg_id].str = saved_vars[i].str;
+	    }
 	  else
 	    variable_values[arg_id].num = saved_vars[i].num;
 	}
@@ -573,12 +1314,14 @@ eval_fn_or_array (unsigned short id, struct list_header *arg_list)
   if (fn_or_array->array_dimension != NULL)
     {
       unsigned long index;
-      unsigned short indices[32];
+      unsigned long indices[32];
 
-      /* Find the index into the array first */
-      if (get_indices (arg_list, indices, fn_or_array->num_args, 0))
-	return ((fn_or_array->type == '$')
-		? (var_u) (struct string_value *) NULL : (var_u) 0.0);
+      /* Find the index into the array first; the
+       * indices have already been evaluated as arguments. */
+      for (i = 0; i < fn_or_array->num_args; i++)
+	if (set_index (indices, i, fn_or_array->num_args, args[i].num, 0))
+	  return ((fn_or_array->type == '$')
+		  ? (var_u) (struct string_value *) NULL : (var_u) 0.0);
       index = array_lookup (fn_or_array, indices);
       if (index == (unsigned long) -1)
 	return ((fn_or_array->type == '$')
@@ -586,16 +1329,8 @@ eval_fn_or_array (unsigned short id, struct list_header *arg_list)
 
       if (fn_or_array->type == '$')
 	{
-	  struct string_value *sresult, *sp;
-	  sp = ((struct string_value **) fn_or_array->array_data)[index];
-	  /* We must return a *copy* of the string, -not- the string itself! */
-	  sresult = (struct string_value *) calloc
-	    (1, WALIGN (sizeof (struct string_value)
-			+ ((sp == NULL) ? 0 : sp->length) + 1));
-	  if (sp != NULL)
-	    memcpy (sresult, sp,
-		    WALIGN (sizeof (struct string_value) + sp->length + 1));
-	  return (var_u) sresult;
+	  /* The element is used in place, like a constant */
+	  return (var_u) string_element (fn_or_array, index);
 	} else {
 	  return (var_u) ((double *) fn_or_array->array_data)[index];
 	}
@@ -717,6 +1452,7 @@ cmd_def (struct statement_header *stmt)
       memset (new_function, 0, sizeof (struct fndef));
       new_function->name_index = func_id;
     }
+  function_generation++;
   new_function->type = func_type;
   new_function->num_args = var_list->num_items;
   new_function->argtypes = argtypes;
@@ -741,18 +1477,21 @@ cmd_def (struct statement_header *stmt)
 }
 
 
-void
-cmd_dim (struct statement_header *stmt)
+/* Common routine for DIM and REDIM PRESERVE, which define or
+ * resize each of the arrays in the list starting at `tp' */
+static void
+define_arrays (unsigned short *tp, int preserve)
 {
+  const char *caller = preserve ? "cmd_redim" : "cmd_dim";
   struct list_header *dim_list;
   struct list_item *lp;
-  unsigned short *tp;
+  unsigned short *sp;
+  const char *filename;
   int i, id;
 
-  tp = &stmt->tokens[0];
   if (*tp != ITEMLIST)
     {
-      fputs ("cmd_dim(): unexpected token ", stderr);
+      fprintf (stderr, "%s(): unexpected token ", caller);
       list_token (tp, stderr);
       fputc ('\n', stderr);
       return;
@@ -764,7 +1503,7 @@ cmd_dim (struct statement_header *stmt)
       tp = &lp->tokens[0];
       if ((*tp != IDENTIFIER) && (*tp != STRINGIDENTIFIER))
 	{
-	  fputs ("cmd_dim(): unexpected token ", stderr);
+	  fprintf (stderr, "%s(): unexpected token ", caller);
 	  list_token (tp, stderr);
 	  fputc ('\n', stderr);
 	  return;
@@ -773,21 +1512,34 @@ cmd_dim (struct statement_header *stmt)
       id = *tp++;
       if (*tp != '(')
 	{
-	  fputs ("cmd_dim(): unexpected token ", stderr);
+	  fprintf (stderr, "%s(): unexpected token ", caller);
 	  list_token (tp, stderr);
 	  fprintf (stderr, " after identifier %s\n", name_table[id]->contents);
 	  return;
 	}
       if (*(++tp) != ITEMLIST)
 	{
-	  fputs ("cmd_dim(): unexpected token ", stderr);
+	  fprintf (stderr, "%s(): unexpected token ", caller);
 	  list_token (tp, stderr);
 	  fprintf (stderr, " after identifier %s(\n",
 		   name_table[id]->contents);
 	  return;
 	}
       ++tp;
-      dim (id, (struct list_header *) tp);
+      /* The array may be followed by the name of a file to keep it in */
+      filename = NULL;
+      sp = &tp[((struct list_header *) tp)->length / sizeof (short)];
+      if (((char *) &sp[1] < &((char *) lp)[lp->length])
+	  && (sp[1] == ARRAYFILE))
+	filename = ((struct string_value *) &sp[3])->contents;
+      if (preserve && (filename != NULL))
+	{
+	  printf ("ERROR - REDIM: %s CANNOT BE MOVED TO A FILE\n",
+		  name_table[id]->contents);
+	  executing = 0;
+	  return;
+	}
+      dim (id, (struct list_header *) tp, filename, preserve);
 
       /* Skip the item delimiter (',') */
       tp = (unsigned short *) &((char *) lp)[lp->length];
@@ -795,11 +1547,31 @@ cmd_dim (struct statement_header *stmt)
     }
 }
 
+void
+cmd_dim (struct statement_header *stmt)
+{
+  define_arrays (&stmt->tokens[0], 0);
+}
+
+void
+cmd_redim (struct statement_header *stmt)
+{
+  if (stmt->tokens[0] != PRESERVE)
+    {
+      fputs ("cmd_redim(): unexpected token ", stderr);
+      list_token (&stmt->tokens[0], stderr);
+      fputc ('\n', stderr);
+      return;
+    }
+  define_arrays (&stmt->tokens[1], 1);
+}
+
 /* DEBUG: Dump the current program's data structures */
 void
 dump (void)
 {
   int i;
+  struct line_header *lp;
 
   printf ("BASIC: %d entries in the name table:\n", name_table_size);
   for (i = 0; i < name_table_size; i++)
@@ -827,19 +1599,20 @@ dump (void)
 		    : ((j < 26) ? ('A' + j - 3) : ('i' + j - 26)));
 	} else {
 	  for (j = 0; j < function_table[i].num_args; j++)
-	    printf ("%d,", function_table[i].array_dimension[j]);
+	    printf ("%lu,", function_table[i].array_dimension[j]);
 	}
       printf ("\b)\n");
     }
 
   printf ("%d lines in the program:\n", program_size);
-  for (i = 0; i < program_size; i++)
+  for (lp = find_line (0, 1); lp != NULL;
+       lp = find_line (lp->line_number + 1, 1))
     {
       int j;
 
-      printf ("%5u: %d bytes:", program[i]->line_number, program[i]->length);
-      for (j = 0; j < program[i]->length / sizeof (short); j++)
-	printf (" %04X", ((unsigned short *) &program[i]->statement)[j]);
+      printf ("%5u: %d bytes:", lp->line_number, lp->length);
+      for (j = 0; j < lp->length / sizeof (short); j++)
+	printf (" %04X", ((unsigned short *) &lp->statement)[j]);
       printf ("\n");
     }
 
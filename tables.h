@@ -10,11 +10,21 @@
 #define MAX_LOAD_NESTING 5
 
 struct string_value {
-  unsigned short length;	/* Size in bytes of the string, *not*
-				 * including the length or null padding. */
+  unsigned short refs;		/* Number of references to the string
+				 * besides the first, or STATIC_STRING */
+  unsigned int length;		/* Size in bytes of the string, *not*
+				 * including the header or null padding. */
+  unsigned int capacity;	/* Size in bytes of the room for contents
+				 * if it was made larger to append to the
+				 * string in place, or 0 if not. */
   char contents[0];		/* Variable-length, null-terminated,
 				 * null padded to short boundary */
-};
+} __attribute__ ((packed));
+
+/* A string constant in the token stream (or the empty string), which
+ * is shared without counting and never freed.  Strings are never
+ * changed once they are shared; see share_string(). */
+#define STATIC_STRING 0xffff
 
 struct list_item {
   unsigned short length;	/* Size in bytes of the item,
@@ -29,6 +39,12 @@ struct list_header {
   struct list_item item[0];
 };
 
+/* True if the identifier before TP is subscripted or called.  An
+ * expression need not be followed by a separator (as in PRINT A$ B$),
+ * so the next item's length may look like a '('; the ITEMLIST after
+ * it tells them apart.  Needs basic.tab.h. */
+#define HAS_ARGUMENTS(tp) (((tp)[0] == '(') && ((tp)[1] == ITEMLIST))
+
 struct statement_header {
   unsigned short length;	/* Size in bytes of the statement,
 				 * including this header. */
@@ -70,14 +86,20 @@ struct fndef {
 				 * function to prevent recursion */
   char type;			/* Numeric or string function?	*/
   unsigned char num_args;	/* Number of arguments -- 1-32	*/
+  char array_file;		/* Set if the array is mapped from a file */
   unsigned long argtypes;	/* Bitmask of argument types; (1 << n)
 				 * masks type of argument n+1,
 				 * 1 for string, 0 for numeric	*/
   var_u (*built_in) (var_u *);	/* Pointer to function if it's built-in */
   unsigned short *arg_ids;	/* ID(s) of the arguments for user-defined */
   struct statement_header *expr; /* Function definition for user-defined */
-  unsigned short *array_dimension; /* For arrays, the size of each dimension */
-  void *array_data;		/* For arrays, the array data	*/
+  unsigned long *array_dimension; /* For arrays, the size of each dimension */
+  unsigned long *array_stride;	/* For arrays, the number of elements
+				 * between successive indices in each
+				 * dimension			*/
+  unsigned long array_size;	/* For arrays, the number of elements */
+  void *array_data;		/* For arrays, the array data; for
+				 * string arrays, see tables.c	*/
 };
 
 /* The variable name table. */
@@ -90,23 +112,114 @@ extern var_u *variable_values;
 /* The function table. */
 extern int function_table_size; /* Number of functions defined	*/
 extern struct fndef *function_table;
+/* Incremented every time a function or array is defined */
+extern unsigned long function_generation;
 
 /* Keep track of how far we've nested LOAD commands */
 extern signed int current_load_nesting;
 
-/* The program. */
+/* The program is kept in a skip list ordered by line number,
+ * so lines can be found, added, or removed in O(log n) time. */
+#define LINE_INDEX_LEVELS 16
+
+/* Operations of the bytecode engine used by `RUN FAST'.
+ * Expressions are compiled to postfix code for a stack machine;
+ * each statement's code ends with one of the statement operations. */
+enum opcode {
+  /* Expression operations */
+  OP_CONST,		/* Push the number in the next word	*/
+  OP_LOAD,		/* Push the variable indexed by the next word */
+  OP_EVAL,		/* Push the value of the operand at the token
+			 * pointer in the next word, using eval_number() */
+  OP_CALL,		/* Call the built-in function in the next word
+			 * with the number of arguments in the word after */
+  OP_FN,		/* Push the value of the function or array at the
+			 * function table index in the next word, called
+			 * with the arguments at the token pointer after */
+  OP_HOT,		/* Count down the next word, then compile the
+			 * expression, whose length in words is in the
+			 * word after, to native code when it reaches 0 */
+  OP_NATIVE,		/* Call the native code in the next word for the
+			 * value of the expression, then skip it	*/
+  OP_INTERP,		/* The expression can't be compiled to native
+			 * code; skip this and the next two words	*/
+  OP_DUP,		/* Push another copy of the top of the stack */
+  OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_POW,
+  OP_NEG, OP_NOT,
+  OP_EQ, OP_NE, OP_LT, OP_GT, OP_LE, OP_GE,
+  OP_AND, OP_OR,
+  /* Statement operations; these finish the statement */
+  OP_LET,		/* Pop into the variable indexed by the next word */
+  OP_IF,		/* Pop a condition; the next word points to
+			 * the statement following the THEN */
+  OP_COMMAND,		/* Execute the statement in the next word
+			 * with the tree-walking interpreter	*/
+  OP_VALUE,		/* End of an expression compiled by itself;
+			 * its value is the result		*/
+};
+
+/* Native code for an expression, as generated by the JIT compiler */
+typedef double (*native_expr) (void);
+
+/* One word of compiled code: an operation or its operand */
+union bytecode {
+  enum opcode op;
+  double number;
+  unsigned long index;
+  unsigned short *tokens;
+  struct statement_header *stmt;
+  var_u (*built_in) (var_u *);
+  native_expr native;
+};
+
+/* Information cached for each statement in a program line */
+struct statement_info {
+  struct statement_header *stmt; /* The statement itself	*/
+  struct program_line *target;	/* For GOTO, GOSUB, or THEN/ELSE with a
+				 * constant line number, the line named */
+  struct program_line *destination; /* Where control ends up after
+				 * following any chain of GOTOs	*/
+  union bytecode *code;		/* The compiled statement, or NULL
+				 * if the line has not been compiled */
+  struct program_line *loop_line; /* For FOR, the line with the NEXT which
+				 * a loop with no iterations skips to;
+				 * for NEXT, the line with its FOR.
+				 * NULL if it has to be searched for. */
+  unsigned short loop_statement; /* The index of that statement	*/
+  unsigned short loop_item;	/* For FOR, which variable of the NEXT
+				 * names the loop		*/
+};
+
+struct program_line {
+  struct line_header *line;	/* The tokenized line		*/
+  unsigned short num_statements; /* Number of statements on the line */
+  struct statement_info *statement; /* Cached statement information;
+				 * NULL if not linked yet	*/
+  union bytecode *code;		/* Compiled code for all statements
+				 * on the line, or NULL		*/
+  unsigned long code_generation; /* Function table generation
+				 * the code was compiled for	*/
+  int levels;			/* Number of forward pointers	*/
+  struct program_line *next[0];	/* The following line at each level;
+				 * next[0] is the very next line. */
+};
+
 extern int program_size;	/* Number of lines in the program */
-extern struct line_header **program;
+/* Incremented every time a line is added or removed */
+extern unsigned long program_generation;
 
 /* Program state. */
 extern int executing;
 extern unsigned long current_line;
-extern unsigned long current_data_line;
 extern unsigned short current_statement;
-extern unsigned short current_data_statement;
-extern unsigned short current_data_item;
 extern struct line_header *immediate_line;
 extern int tracing;
+extern int fast_execution;	/* Use the bytecode engine	*/
+extern int fast_default;	/* ... for every RUN, not just RUN FAST */
+extern int fixed_loop_limits;	/* Evaluate FOR's TO and STEP only once */
+extern unsigned long stack_limit; /* Deepest GOSUB or FOR nesting */
+extern unsigned long array_memory_limit; /* Most bytes arrays may use */
+extern int jit_enabled;		/* Compile hot expressions to native code */
 extern int current_column;
 
 /* Trace flags (bits); the first three are for BASIC language level tracing */
@@ -122,12 +235,20 @@ extern int current_column;
 void initialize_tables (void);
 void initialize_builtin_functions (void);
 /* This function returns the index of a variable name in the name table.
- * If the name does not already exist, it is added. */
-unsigned short find_var_name (const char *name);
+ * If the name does not already exist, it is added.  Returns -1 if
+ * the table is full, leaving it as it was. */
+int find_var_name (const char *name);
+/* This function returns the function or array with the given name,
+ * or NULL if there is none. */
+struct fndef *find_function (unsigned short id);
+/* Free the memory used by a function or array */
+void free_function (struct fndef *fn);
 /* This function returns the line with the given number.
  * If the flag is true and the given line does not exist,
  * the next existing line is returned. */
 struct line_header *find_line (unsigned long number, int after);
+/* Same as find_line, but returns the program index entry for the line */
+struct program_line *find_program_line (unsigned long number, int after);
 /* Search a given line for the Nth statement */
 struct statement_header *find_statement (struct line_header *line,
 					 unsigned short statement_number);
@@ -141,15 +262,71 @@ void list_statement (struct statement_header *sp, FILE *to);
 /* List a token from a program statement */
 int list_token (unsigned short *tp, FILE *to);
 void remove_line (unsigned long number);
+/* Remove all lines from the program */
+void clear_program (void);
 void execute (struct line_header *);
+void execute_statement (struct statement_header *);
+void if_branch (struct statement_header *then_stmt, double condition);
+/* Compile a line for the bytecode engine, and run a compiled statement */
+void compile_line (struct program_line *pl);
+void free_line_code (struct program_line *pl);
+void execute_compiled (struct program_line *pl, unsigned short index);
+long compile_numeric (unsigned short **tpp, union bytecode **code);
+/* Keep postfix code for each numeric expression on a line, and use it
+ * to evaluate the expression at the token pointer if there is some */
+void compile_postfix (struct line_header *line);
+void free_postfix (struct line_header *line);
+int eval_postfix (unsigned short **tpp, double *result);
+/* Write the program out as a C program */
+int translate_program (FILE *out);
+/* Compile bytecode for an expression to native code; NULL if we can't */
+native_expr jit_expression (union bytecode *code, unsigned long length);
+/* Discard all native code */
+void jit_reset (void);
 double eval_number (unsigned short **);
 double eval_numexpr (unsigned short **);
 struct string_value *eval_string (unsigned short **);
+/* Strings returned by eval_string() and string functions are references
+ * which must be released.  share_string() adds a reference (to the empty
+ * string if given NULL), and keep_string() makes a reference safe to
+ * store in a variable, copying it if it is in the token stream.
+ * new_string() makes a string from the given characters; empty and
+ * single-character strings come from a table instead of the heap. */
+struct string_value *new_string (const char *contents, int length);
+/* Temporary strings come from scratch memory, which is freed in one go
+ * by reset_scratch() at the end of each statement, or back to a point
+ * saved by mark_scratch() with release_scratch(). */
+struct scratch_mark {
+  void *block;
+  size_t used;
+};
+struct string_value *scratch_string (int length);
+void reset_scratch (void);
+void mark_scratch (struct scratch_mark *mark);
+void release_scratch (const struct scratch_mark *mark);
+struct string_value *share_string (struct string_value *string);
+struct string_value *keep_string (struct string_value *string);
+/* Append to a string stored in a variable; see cmd_let() */
+struct string_value *append_string (struct string_value *string,
+				    const struct string_value *tail);
+void release_string (struct string_value *string);
 double eval_strcond (unsigned short **);
 var_u eval_fn_or_array (unsigned short id, struct list_header *arg_list);
+/* Check a call site's arguments against a function ahead of time,
+ * then call it through its function table index */
+int check_arguments (struct fndef *fn, struct list_header *arg_list);
+var_u eval_bound_function (unsigned long slot, unsigned short *tp);
 double *num_array_lookup (unsigned short id, struct list_header *index_list);
-struct string_value **str_array_lookup (unsigned short id,
-					struct list_header *index_list);
+/* Evaluate a list of array indices (or with DIM, dimensions) */
+int get_indices (struct list_header *index_list, unsigned long *indices,
+		 int nargs, int dim_or_index);
+/* Define (or redefine) a variable as an array of the given dimensions */
+struct fndef *dim_array (unsigned short id, int num_dimensions,
+			 const unsigned long *dim_size);
+/* Start reading DATA from the given line (or the next one with DATA) */
+void restore_data (unsigned long line_number);
+long str_array_lookup (unsigned short id, struct list_header *index_list);
+void set_str_array (unsigned short id, long index, struct string_value *value);
 
 /* BASIC commands */
 void cmd_bye (struct statement_header *);
@@ -166,12 +343,14 @@ void cmd_input (struct statement_header *);
 void cmd_let (struct statement_header *);
 void cmd_list (struct statement_header *);
 void cmd_load (struct statement_header *);
+void cmd_mat (struct statement_header *);
 void cmd_new (struct statement_header *);
 void cmd_next (struct statement_header *);
 void cmd_on (struct statement_header *);
 void cmd_pause (struct statement_header *);
 void cmd_print (struct statement_header *);
 void cmd_read (struct statement_header *);
+void cmd_redim (struct statement_header *);
 void cmd_rem (struct statement_header *);
 void cmd_restore (struct statement_header *);
 void cmd_return (struct statement_header *);
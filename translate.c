@@ -0,0 +1,1143 @@
+/* Translate a BASIC program into C, for `basic --emit-c'
+ *
+ * The translated program is linked with the interpreter's own
+ * library (libbasic.a), and loads a copy of every tokenized line
+ * at startup so that PRINT, INPUT, READ, DIM, DEF and the other
+ * statements which do their own work can still be run through
+ * execute_statement().  What gets compiled is the control flow and
+ * the numeric arithmetic: every statement becomes a label in one C
+ * function, GOTO, GOSUB, IF, FOR and NEXT become jumps, and any
+ * numeric expression the bytecode compiler understands becomes a
+ * C expression.  The GOSUB and FOR...NEXT stacks are kept by the
+ * generated code, following the same rules as run.c.
+ *
+ * Programs which change themselves while running (LOAD or NEW
+ * from within the program) can't be translated meaningfully. */
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tables.h"
+#include "basic.tab.h"
+
+
+/* The program being translated, in order.  Every statement is
+ * numbered consecutively through the program; the statements of
+ * line N start at line_start[N], and line_start[num_lines] is one
+ * past the last statement, which is where the program ends. */
+static struct line_header **lines;
+static int num_lines;
+static int *line_start;
+static struct statement_header **statements;
+static int *statement_line;
+static int num_statements;
+
+/* The built-in functions, in the order of the generated table */
+static struct fndef **builtins;
+static int num_builtins;
+
+/* Which parts of the run-time support the program needs */
+static int uses_gosub, uses_for, uses_line_index, uses_dispatch;
+
+/* Where the generated code goes */
+static FILE *out;
+/* Number of temporaries declared in the current block */
+static int temp_count;
+/* Set when code has been generated which could stop the program
+ * (any call into the interpreter), until the check has been made */
+static int may_stop;
+/* Number of statements we couldn't translate */
+static int errors;
+
+
+/* Allocate a formatted string */
+static char *
+format (const char *fmt, ...)
+{
+  va_list ap;
+  int size;
+  char *text;
+
+  va_start (ap, fmt);
+  size = vsnprintf (NULL, 0, fmt, ap);
+  va_end (ap);
+  text = (char *) malloc (size + 1);
+  va_start (ap, fmt);
+  vsprintf (text, fmt, ap);
+  va_end (ap);
+  return text;
+}
+
+/* Return the token which ends a statement */
+static unsigned short
+statement_tail (struct statement_header *stmt)
+{
+  return *((unsigned short *) &((char *) stmt)[stmt->length - sizeof (short)]);
+}
+
+/* Offset of a token (or statement) from the start of its line */
+static long
+line_offset (int line, void *tp)
+{
+  return (char *) tp - (char *) lines[line];
+}
+
+/* Report a statement which can't be translated */
+static void
+translate_error (int id, const char *message)
+{
+  fprintf (stderr, "--emit-c: Line %lu statement %d: %s\n",
+	   lines[statement_line[id]]->line_number,
+	   id - line_start[statement_line[id]] + 1, message);
+  errors++;
+}
+
+/* Return the first statement of the line with the given number,
+ * or -1 if there is no such line */
+static int
+find_target (unsigned long number)
+{
+  int low = 0, high = num_lines - 1, mid;
+
+  while (low <= high)
+    {
+      mid = (low + high) / 2;
+      if (lines[mid]->line_number == number)
+	return line_start[mid];
+      if (lines[mid]->line_number < number)
+	low = mid + 1;
+      else
+	high = mid - 1;
+    }
+  return -1;
+}
+
+/* If a GOTO or GOSUB goes to a constant line number, return
+ * the number in *number; otherwise return 0.  This is the
+ * same test that constant_target() in run.c makes. */
+static int
+constant_line (struct statement_header *stmt, unsigned long *number)
+{
+  unsigned short *tp = &stmt->tokens[0];
+
+  if (*tp++ != INTEGER)
+    return 0;
+  *number = *((unsigned long *) tp);
+  tp = (unsigned short *) &((unsigned long *) tp)[1];
+  return ((*tp == ':') || (*tp == '\n') || (*tp == ELSE));
+}
+
+/* Generate a jump to a statement.  current_line
+ * is set at the start of each line, so jumps into
+ * the middle of a line have to set it themselves. */
+static void
+emit_jump (const char *indent, int id)
+{
+  if (id >= num_statements)
+    fprintf (out, "%sgoto done;\n", indent);
+  else if (line_start[statement_line[id]] == id)
+    fprintf (out, "%sgoto s%d;\n", indent, id);
+  else
+    fprintf (out, "%s{ current_line = %luUL; goto s%d; }\n", indent,
+	     lines[statement_line[id]]->line_number, id);
+}
+
+/* Stop the program if something in the interpreter said so */
+static void
+emit_check (void)
+{
+  if (may_stop)
+    fputs ("    if (!executing) goto done;\n", out);
+  may_stop = 0;
+}
+
+
+/* Format a numeric constant so that the C compiler reads back
+ * exactly the same double */
+static char *
+format_constant (double value)
+{
+  if ((value == floor (value)) && (fabs (value) < 1.0e15))
+    return format ("%.1f", value);
+  return format ("%a", value);
+}
+
+/* Return the slot in the generated table for a built-in function */
+static int
+builtin_slot (var_u (*built_in) (var_u *))
+{
+  int i;
+
+  for (i = 0; i < num_builtins; i++)
+    if (builtins[i]->built_in == built_in)
+      return i;
+  /* compile_call() only takes functions out of the function table */
+  fputs ("builtin_slot(): Unknown built-in function\n", stderr);
+  abort ();
+}
+
+/* Translate compiled code for an expression into a C expression.
+ * Operands which call into the interpreter are assigned to
+ * temporaries first, in the order the interpreter would evaluate
+ * them; everything else is arithmetic on doubles, which C does
+ * in exactly the same way the bytecode engine does. */
+static char *
+translate_code (int line, union bytecode *code, long length)
+{
+  char **stack, *a, *b, *text;
+  const char *op;
+  long pc = 0;
+  int sp = 0, i, nargs, t;
+
+  stack = (char **) malloc (sizeof (char *) * (length + 1));
+  while (pc < length)
+    {
+      switch (code[pc++].op)
+	{
+	case OP_CONST:
+	  stack[sp++] = format_constant (code[pc++].number);
+	  continue;
+
+	case OP_LOAD:
+	  stack[sp++] = format ("V(%lu)", code[pc++].index);
+	  continue;
+
+	case OP_FN:
+	  /* The function table of the translated program
+	   * is built when it runs; just evaluate the call. */
+	  pc++;
+	  /* Fall through */
+	case OP_EVAL:
+	  t = temp_count++;
+	  fprintf (out, "    double t%d = bas_eval (T(%d, %ld));\n",
+		   t, line, line_offset (line, code[pc++].tokens));
+	  stack[sp++] = format ("t%d", t);
+	  may_stop = 1;
+	  continue;
+
+	case OP_CALL:
+	  nargs = code[pc + 1].index;
+	  t = temp_count++;
+	  fprintf (out, "    var_u a%d[%d];\n", t, nargs ? nargs : 1);
+	  sp -= nargs;
+	  for (i = 0; i < nargs; i++)
+	    {
+	      fprintf (out, "    a%d[%d].num = %s;\n", t, i, stack[sp + i]);
+	      free (stack[sp + i]);
+	    }
+	  fprintf (out, "    double t%d = builtin[%d] (a%d).num;\n",
+		   t, builtin_slot (code[pc].built_in), t);
+	  pc += 2;
+	  stack[sp++] = format ("t%d", t);
+	  may_stop = 1;
+	  continue;
+
+	case OP_DUP:
+	  stack[sp] = format ("%s", stack[sp - 1]);
+	  sp++;
+	  continue;
+
+	case OP_NEG:
+	  a = stack[sp - 1];
+	  stack[sp - 1] = format ("(-%s)", a);
+	  free (a);
+	  continue;
+
+	case OP_NOT:
+	  a = stack[sp - 1];
+	  stack[sp - 1] = format ("bas_not (%s)", a);
+	  free (a);
+	  continue;
+
+	case OP_ADD: op = "+"; break;
+	case OP_SUB: op = "-"; break;
+	case OP_MUL: op = "*"; break;
+	case OP_DIV: op = "/"; break;
+	case OP_POW: op = "pow"; break;
+	case OP_EQ: op = "bas_eq"; break;
+	case OP_NE: op = "bas_ne"; break;
+	case OP_LT: op = "bas_lt"; break;
+	case OP_GT: op = "bas_gt"; break;
+	case OP_LE: op = "bas_le"; break;
+	case OP_GE: op = "bas_ge"; break;
+	case OP_AND: op = "bas_and"; break;
+	case OP_OR: op = "bas_or"; break;
+
+	default:
+	  fprintf (stderr, "translate_code(): Unexpected operation %d\n",
+		   (int) code[pc - 1].op);
+	  abort ();
+	}
+
+      /* Binary operation */
+      b = stack[--sp];
+      a = stack[--sp];
+      if (op[1] == '\0')
+	stack[sp++] = format ("(%s %s %s)", a, op, b);
+      else
+	stack[sp++] = format ("%s (%s, %s)", op, a, b);
+      free (a);
+      free (b);
+    }
+
+  text = stack[0];
+  free (stack);
+  return text;
+}
+
+/* Translate the numeric expression at *tpp, advancing the token
+ * pointer past it.  Returns NULL if the bytecode compiler can't
+ * make sense of it. */
+static char *
+translate_expression (int line, unsigned short **tpp)
+{
+  union bytecode *code;
+  long length;
+
+  length = compile_numeric (tpp, &code);
+  if (length <= 0)
+    return NULL;
+  return translate_code (line, code, length);
+}
+
+/* Translate a numeric expression which ends the statement, leaving
+ * it to the interpreter if the bytecode compiler can't handle it */
+static char *
+translate_value (int line, unsigned short *tp)
+{
+  char *text = translate_expression (line, &tp);
+
+  if (text != NULL)
+    return text;
+  may_stop = 1;
+  return format ("bas_eval (T(%d, %ld))", line, line_offset (line, tp));
+}
+
+
+/* Run a statement through the interpreter */
+static void
+translate_command (int id)
+{
+  int line = statement_line[id];
+
+  fprintf (out, "    execute_statement (S(%d, %ld));\n",
+	   line, line_offset (line, statements[id]));
+  may_stop = 1;
+}
+
+/* LET: only assignments to simple numeric variables are compiled */
+static void
+translate_let (int id)
+{
+  struct statement_header *stmt = statements[id];
+  unsigned short *tp = &stmt->tokens[0];
+  unsigned short var;
+  char *value;
+
+  if ((tp[0] != NUMLVAL) || (tp[1] != IDENTIFIER)
+      || (tp[3] != '=') || (tp[4] != NUMEXPR))
+    {
+      translate_command (id);
+      return;
+    }
+  var = tp[2];
+  tp += 5;
+  value = translate_expression (statement_line[id], &tp);
+  if ((value == NULL)
+      || ((*tp != ':') && (*tp != '\n') && (*tp != ELSE)))
+    {
+      free (value);
+      translate_command (id);
+      return;
+    }
+  fprintf (out, "    V(%u) = %s;\n", var, value);
+  free (value);
+}
+
+/* Where to go when an IF condition is false; see if_branch() */
+static int
+if_false_target (int id)
+{
+  int end = line_start[statement_line[id] + 1];
+  int j = id + 1;
+  unsigned short terminator;
+
+  if (j >= end)
+    return end;
+  terminator = statement_tail (statements[j]);
+  /* An implied GOTO followed by another statement has an implied ELSE */
+  if ((statements[j]->command == _GOTO_) && (terminator == ':'))
+    return j + 1;
+  while (terminator != '\n')
+    {
+      if ((terminator == THEN) || (terminator == _THEN_)
+	  || (terminator == ':'))
+	{
+	  if (++j >= end)
+	    return end;
+	  terminator = statement_tail (statements[j]);
+	  continue;
+	}
+      if (terminator == ELSE)
+	return j + 1;
+      break;
+    }
+  return end;
+}
+
+static void
+translate_if (int id)
+{
+  struct if_header *if_stmt = (struct if_header *) statements[id];
+  unsigned short *tp = &if_stmt->tokens[0];
+  char *condition;
+
+  condition = translate_expression (statement_line[id], &tp);
+  if (condition == NULL)
+    {
+      tp = &if_stmt->tokens[0];
+      condition = translate_value (statement_line[id], tp);
+    }
+  else if ((*tp != THEN) && (*tp != _THEN_))
+    {
+      free (condition);
+      translate_error (id, "IF without THEN");
+      return;
+    }
+  fprintf (out, "    double c = %s;\n", condition);
+  free (condition);
+  emit_check ();
+  fputs ("    if (c == 0.0)\n", out);
+  emit_jump ("      ", if_false_target (id));
+}
+
+/* GOTO and GOSUB */
+static void
+translate_goto (int id)
+{
+  struct statement_header *stmt = statements[id];
+  const char *name = (stmt->command == GOSUB) ? "GOSUB" : "GOTO";
+  unsigned long number;
+  char *value;
+  int target;
+
+  if (constant_line (stmt, &number))
+    {
+      target = find_target (number);
+      if (target < 0)
+	{
+	  fprintf (out, "    puts (\"ERROR - %s: NO LINE %lu\");\n"
+		   "    executing = 0;\n    goto done;\n", name, number);
+	  return;
+	}
+      if (stmt->command == GOSUB)
+	fprintf (out, "    if (!push_gosub (%d)) goto done;\n", id + 1);
+      emit_jump ("    ", target);
+      return;
+    }
+
+  value = translate_value (statement_line[id], &stmt->tokens[0]);
+  fprintf (out, "    unsigned long number = (unsigned long) %s;\n", value);
+  free (value);
+  emit_check ();
+  fprintf (out, "    target = line_index (number);\n"
+	   "    if (target < 0)\n      {\n"
+	   "        printf (\"ERROR - %s: NO LINE %%u\\n\", "
+	   "(unsigned int) number);\n"
+	   "        executing = 0;\n        goto done;\n      }\n", name);
+  if (stmt->command == GOSUB)
+    fprintf (out, "    if (!push_gosub (%d)) goto done;\n", id + 1);
+  fputs ("    goto dispatch;\n", out);
+}
+
+static void
+translate_on (int id)
+{
+  struct statement_header *stmt = statements[id];
+  unsigned short *tp = &stmt->tokens[0];
+  struct list_header *list;
+  struct list_item *item;
+  unsigned long number;
+  char *value;
+  int i, op, target;
+
+  value = translate_expression (statement_line[id], &tp);
+  op = *tp++;
+  if ((value == NULL) || ((op != GOTO) && (op != GOSUB))
+      || (*tp++ != ITEMLIST))
+    {
+      free (value);
+      translate_error (id, "Can't translate ON");
+      return;
+    }
+  fprintf (out, "    int index = (unsigned long) %s;\n", value);
+  free (value);
+  emit_check ();
+  fputs ("    if (index < 1)\n      index = 1;\n    switch (index)\n      {\n",
+	 out);
+  list = (struct list_header *) tp;
+  item = &list->item[0];
+  for (i = 1; i <= list->num_items; i++)
+    {
+      number = *((unsigned long *) &item->tokens[1]);
+      target = find_target (number);
+      fprintf (out, "      case %d:\n", i);
+      if (target < 0)
+	fprintf (out, "        puts (\"ERROR - ON..%s: NO LINE %lu\");\n"
+		 "        executing = 0;\n        goto done;\n",
+		 (op == GOTO) ? "GOTO" : "GOSUB", number);
+      else
+	{
+	  if (op == GOSUB)
+	    fprintf (out, "        if (!push_gosub (%d)) goto done;\n",
+		     id + 1);
+	  emit_jump ("        ", target);
+	}
+      /* Skip over this item and the separator (',') */
+      item = (struct list_item *) &((char *) item)[item->length + sizeof (short)];
+    }
+  fputs ("      }\n", out);
+}
+
+static void
+translate_return (int id)
+{
+  fputs ("    if (gosub_size <= 0)\n      {\n"
+	 "        puts (\"ERROR - RETURN: NOT IN SUBROUTINE\");\n"
+	 "        executing = 0;\n        goto done;\n      }\n"
+	 "    target = gosub_stack[--gosub_size];\n"
+	 "    goto dispatch;\n", out);
+}
+
+/* Find the parts of a FOR statement.  Returns the loop variable,
+ * or -1 if the statement can't be translated. */
+static int
+for_parts (int id, char **initial, char **limit, char **step)
+{
+  struct statement_header *stmt = statements[id];
+  unsigned short *tp = &stmt->tokens[0];
+  int line = statement_line[id];
+
+  *initial = *limit = *step = NULL;
+  if ((tp[0] != NUMLVAL) || (tp[1] != IDENTIFIER)
+      || (tp[3] != '=') || (tp[4] != NUMEXPR))
+    return -1;
+  tp += 5;
+  *initial = translate_expression (line, &tp);
+  if ((*initial == NULL) || (*tp++ != TO))
+    return -1;
+  *limit = translate_expression (line, &tp);
+  if (*limit == NULL)
+    return -1;
+  if (*tp++ == STEP)
+    {
+      *step = translate_expression (line, &tp);
+      if (*step == NULL)
+	return -1;
+    }
+  else
+    *step = format ("1.0");
+  return stmt->tokens[2];
+}
+
+/* Generate code for the NEXT on the given variable.  Any loop
+ * which is continued goes back through the dispatcher. */
+static void
+emit_next (const char *indent, const char *var)
+{
+  fprintf (out, "%starget = next_loop (%s);\n"
+	   "%sif (!executing) goto done;\n"
+	   "%sif (target >= 0) goto dispatch;\n",
+	   indent, var, indent, indent);
+}
+
+static void
+translate_for (int id)
+{
+  struct list_header *list;
+  struct list_item *item;
+  char *initial, *limit, *step, *name;
+  int var, j, i = 0;
+
+  var = for_parts (id, &initial, &limit, &step);
+  if (var < 0)
+    {
+      free (initial);
+      free (limit);
+      free (step);
+      translate_error (id, "Can't translate FOR");
+      return;
+    }
+  fprintf (out, "    if (!push_for (%d, %d, %s)) goto done;\n",
+	   var, id, uses_gosub ? "gosub_size" : "0");
+  fprintf (out, "    V(%d) = %s;\n", var, initial);
+  fprintf (out, "    double to = %s;\n", limit);
+  fprintf (out, "    double step = %s;\n", step);
+  if (fixed_loop_limits)
+    fputs ("    for_stack[for_size - 1].to = to;\n"
+	   "    for_stack[for_size - 1].step = step;\n", out);
+  free (initial);
+  free (limit);
+  free (step);
+  emit_check ();
+  fprintf (out, "    if (!((step >= 0.0) ? (V(%d) <= to) : (V(%d) >= to)))\n"
+	   "      {\n", var, var);
+
+  /* The loop is finished before it started, so find the NEXT
+   * statement for this variable just as cmd_for() does. */
+  for (j = id + 1; j < num_statements; j++)
+    {
+      if ((statements[j]->command != NEXT)
+	  || (statements[j]->tokens[0] != ITEMLIST))
+	continue;
+      list = (struct list_header *) &statements[j]->tokens[1];
+      if (list->num_items == 0)
+	break;
+      item = &list->item[0];
+      for (i = 0; i < list->num_items; i++)
+	{
+	  if (item->tokens[0] != IDENTIFIER)
+	    break;
+	  if (item->tokens[1] == var)
+	    break;
+	  item = (struct list_item *) &((char *) item)[item->length + sizeof (short)];
+	}
+      if ((i < list->num_items) && (item->tokens[0] == IDENTIFIER))
+	break;
+    }
+  if (j >= num_statements)
+    /* End of program */
+    fputs ("        goto done;\n", out);
+  else
+    {
+      fputs ("        --for_size;\n", out);
+      /* Continue with the rest of the variables on the NEXT */
+      if (list->num_items > 0)
+	for (i++; i < list->num_items; i++)
+	  {
+	    item = (struct list_item *) &((char *) item)[item->length + sizeof (short)];
+	    if (item->tokens[0] != IDENTIFIER)
+	      break;
+	    name = format ("%u", item->tokens[1]);
+	    emit_next ("        ", name);
+	    free (name);
+	  }
+      emit_jump ("        ", j + 1);
+    }
+  fputs ("      }\n", out);
+}
+
+static void
+translate_next (int id)
+{
+  struct list_header *list;
+  struct list_item *item;
+  char *name;
+  int i;
+
+  if (statements[id]->tokens[0] != ITEMLIST)
+    {
+      translate_error (id, "Can't translate NEXT");
+      return;
+    }
+  fputs ("    if (for_size <= 0)\n      {\n"
+	 "        puts (\"ERROR - NEXT: NOT IN ANY LOOP\\n\");\n"
+	 "        executing = 0;\n        goto done;\n      }\n", out);
+  list = (struct list_header *) &statements[id]->tokens[1];
+  if (list->num_items == 0)
+    {
+      emit_next ("    ", "for_stack[for_size - 1].var");
+      return;
+    }
+  item = &list->item[0];
+  for (i = 0; i < list->num_items; i++)
+    {
+      if (item->tokens[0] != IDENTIFIER)
+	{
+	  translate_error (id, "Can't translate NEXT");
+	  return;
+	}
+      name = format ("%u", item->tokens[1]);
+      emit_next ("    ", name);
+      free (name);
+      item = (struct list_item *) &((char *) item)[item->length + sizeof (short)];
+    }
+}
+
+/* Translate one statement, including going on to the next one */
+static void
+translate_statement (int id)
+{
+  struct statement_header *stmt = statements[id];
+  int line = statement_line[id];
+
+  temp_count = 0;
+  may_stop = 0;
+  fprintf (out, " s%d:\n", id);
+  if (line_start[line] == id)
+    fprintf (out, "  current_line = %luUL;\n", lines[line]->line_number);
+  fputs ("  {\n", out);
+
+  switch (stmt->command)
+    {
+    case CONTINUE:
+      /* A running program hasn't stopped, so there is nothing to do */
+    case DATA:
+    case REM:
+      break;
+
+    case LET:
+    case _LET_:
+      translate_let (id);
+      break;
+
+    case IF:
+      translate_if (id);
+      break;
+
+    case GOTO:
+    case _GOTO_:
+    case GOSUB:
+      translate_goto (id);
+      break;
+
+    case ON:
+      translate_on (id);
+      break;
+
+    case RETURN:
+      translate_return (id);
+      break;
+
+    case FOR:
+      translate_for (id);
+      break;
+
+    case NEXT:
+      translate_next (id);
+      break;
+
+    case RUN:
+      /* Let the interpreter reset everything, then start over */
+      translate_command (id);
+      emit_check ();
+      emit_jump ("    ", 0);
+      break;
+
+    case LOAD:
+    case NEW:
+      translate_error (id, "A program can't be compiled if it changes itself");
+      /* Fall through */
+    default:
+      translate_command (id);
+      break;
+    }
+
+  emit_check ();
+  /* A statement ending with ELSE skips the rest of the line */
+  if (statement_tail (stmt) == ELSE)
+    emit_jump ("    ", line_start[line + 1]);
+  fputs ("  }\n", out);
+}
+
+
+/* Collect the lines and statements of the program,
+ * and see which parts of the run-time support it uses */
+static void
+scan_program (void)
+{
+  struct program_line *pl;
+  struct statement_header *stmt;
+  unsigned long number;
+  int i, id;
+
+  num_lines = 0;
+  for (pl = find_program_line (0, 1); pl != NULL; pl = pl->next[0])
+    num_lines++;
+  lines = (struct line_header **) malloc
+    (sizeof (struct line_header *) * (num_lines + 1));
+  line_start = (int *) malloc (sizeof (int) * (num_lines + 1));
+
+  num_statements = 0;
+  for (i = 0, pl = find_program_line (0, 1); pl != NULL;
+       i++, pl = pl->next[0])
+    {
+      lines[i] = pl->line;
+      line_start[i] = num_statements;
+      for (stmt = &pl->line->statement[0];
+	   (char *) stmt < &((char *) pl->line)[pl->line->length];
+	   stmt = (struct statement_header *) &((char *) stmt)[stmt->length])
+	num_statements++;
+    }
+  line_start[num_lines] = num_statements;
+
+  statements = (struct statement_header **) malloc
+    (sizeof (struct statement_header *) * (num_statements + 1));
+  statement_line = (int *) malloc (sizeof (int) * (num_statements + 1));
+  for (i = 0, id = 0; i < num_lines; i++)
+    for (stmt = &lines[i]->statement[0];
+	 (char *) stmt < &((char *) lines[i])[lines[i]->length];
+	 stmt = (struct statement_header *) &((char *) stmt)[stmt->length])
+      {
+	statements[id] = stmt;
+	statement_line[id++] = i;
+      }
+
+  uses_gosub = uses_for = uses_line_index = uses_dispatch = 0;
+  for (id = 0; id < num_statements; id++)
+    {
+      stmt = statements[id];
+      switch (stmt->command)
+	{
+	case GOSUB:
+	  uses_gosub = 1;
+	  /* Fall through */
+	case GOTO:
+	case _GOTO_:
+	  if (!constant_line (stmt, &number))
+	    uses_line_index = uses_dispatch = 1;
+	  break;
+
+	case ON:
+	  /* We don't know where the GOSUB is until we translate it */
+	  uses_gosub = 1;
+	  break;
+
+	case RETURN:
+	  uses_gosub = uses_dispatch = 1;
+	  break;
+
+	case FOR:
+	case NEXT:
+	  uses_for = uses_dispatch = 1;
+	  break;
+	}
+    }
+
+  /* Every built-in function the program might call */
+  builtins = (struct fndef **) malloc
+    (sizeof (struct fndef *) * (function_table_size + 1));
+  num_builtins = 0;
+  for (i = 0; i < function_table_size; i++)
+    if (function_table[i].built_in != NULL)
+      builtins[num_builtins++] = &function_table[i];
+}
+
+/* Write out the data which the program loads at startup */
+static void
+emit_data (void)
+{
+  unsigned char *bp;
+  int i, j;
+
+  fputs ("/* The variable names, in the order the program was parsed */\n"
+	 "static const char *const names[] = {\n", out);
+  for (i = 0; i < name_table_size; i++)
+    fprintf (out, "  \"%s\",\n", name_table[i]->contents);
+  fputs ("};\n\n", out);
+
+  fputs ("/* The tokenized program */\n", out);
+  for (i = 0; i < num_lines; i++)
+    {
+      fprintf (out, "static const unsigned char line_%d[] = {", i);
+      bp = (unsigned char *) lines[i];
+      for (j = 0; j < lines[i]->length; j++)
+	fprintf (out, "%s0x%02x,", (j % 12) ? " " : "\n  ", bp[j]);
+      fputs ("\n};\n", out);
+    }
+  fputs ("static const unsigned char *const line_data[] = {\n", out);
+  for (i = 0; i < num_lines; i++)
+    fprintf (out, "  line_%d,\n", i);
+  fprintf (out, "};\n#define NUM_LINES %d\n"
+	   "static struct line_header *program[NUM_LINES];\n\n", num_lines);
+
+  fputs ("/* Built-in functions, by name */\n"
+	 "static const unsigned short builtin_id[] = {\n", out);
+  for (i = 0; i < num_builtins; i++)
+    fprintf (out, "  %u,\t/* %s */\n", builtins[i]->name_index,
+	     name_table[builtins[i]->name_index]->contents);
+  fprintf (out, "};\nstatic var_u (*builtin[%d]) (var_u *);\n\n",
+	   num_builtins ? num_builtins : 1);
+}
+
+/* Support code which doesn't depend on the program */
+static const char preamble[] = "\
+#define V(n) (variable_values[n].num)\n\
+#define T(line, offset) \\\n\
+  ((unsigned short *) &((char *) program[line])[offset])\n\
+#define S(line, offset) \\\n\
+  ((struct statement_header *) &((char *) program[line])[offset])\n\
+\n";
+
+static const char arithmetic[] = "\
+/* Evaluate an operand the bytecode compiler left to the interpreter */\n\
+static double\n\
+bas_eval (unsigned short *tp)\n\
+{\n\
+  return eval_number (&tp);\n\
+}\n\
+\n\
+/* Comparisons use a lower precision if the numbers will fit,\n\
+ * just as the interpreter does. */\n\
+static inline double\n\
+reduce_precision (double value)\n\
+{\n\
+  if ((fabs (value) > FLT_MIN) && (fabs (value) < FLT_MAX))\n\
+    {\n\
+      volatile float reduce = value;\n\
+      value = reduce;\n\
+    }\n\
+  return value;\n\
+}\n\
+#define COMPARISON(name, op)\t\t\t\t\t\t\\\n\
+  static inline double\t\t\t\t\t\t\t\\\n\
+  name (double a, double b)\t\t\t\t\t\t\\\n\
+  {\t\t\t\t\t\t\t\t\t\\\n\
+    return (reduce_precision (a) op reduce_precision (b)) ? 1.0 : 0.0;\t\\\n\
+  }\n\
+COMPARISON (bas_eq, ==)\n\
+COMPARISON (bas_ne, !=)\n\
+COMPARISON (bas_lt, <)\n\
+COMPARISON (bas_gt, >)\n\
+COMPARISON (bas_le, <=)\n\
+COMPARISON (bas_ge, >=)\n\
+static inline double\n\
+bas_not (double a)\n\
+{\n\
+  return (a == 0.0) ? 1.0 : 0.0;\n\
+}\n\
+static inline double\n\
+bas_and (double a, double b)\n\
+{\n\
+  return ((a != 0.0) && (b != 0.0)) ? 1.0 : 0.0;\n\
+}\n\
+static inline double\n\
+bas_or (double a, double b)\n\
+{\n\
+  return ((a != 0.0) || (b != 0.0)) ? 1.0 : 0.0;\n\
+}\n\
+\n";
+
+static const char gosub_support[] = "\
+/* Subroutine stack: the statement to return to */\n\
+static int *gosub_stack;\n\
+static int gosub_size, gosub_allocated;\n\
+\n\
+static int\n\
+push_gosub (int id)\n\
+{\n\
+  if (stack_limit && ((unsigned long) gosub_size >= stack_limit))\n\
+    {\n\
+      printf (\"ERROR - GOSUB: SUBROUTINES NESTED DEEPER THAN %lu\\n\",\n\
+\t      stack_limit);\n\
+      executing = 0;\n\
+      return 0;\n\
+    }\n\
+  if (gosub_size >= gosub_allocated)\n\
+    {\n\
+      gosub_allocated = gosub_allocated ? (gosub_allocated * 2) : 16;\n\
+      gosub_stack = (int *) realloc\n\
+\t(gosub_stack, sizeof (int) * gosub_allocated);\n\
+    }\n\
+  gosub_stack[gosub_size++] = id;\n\
+  return 1;\n\
+}\n\
+\n";
+
+static const char for_support[] = "\
+/* FOR...NEXT stack: the loop variable and the FOR statement,\n\
+ * the limits if they are only evaluated by FOR, and the depth\n\
+ * of the subroutine stack; see cmd_for() in run.c */\n\
+static struct {\n\
+  unsigned short var;\n\
+  int id;\n\
+  double to, step;\n\
+  int gosub_level;\n\
+} *for_stack;\n\
+static int for_size, for_allocated;\n\
+\n\
+static int\n\
+push_for (unsigned short var, int id, int gosub_level)\n\
+{\n\
+  int i;\n\
+\n\
+  for (i = for_size - 1; i >= 0; --i)\n\
+    {\n\
+      if (for_stack[i].gosub_level < gosub_level)\n\
+\tbreak;\n\
+      if (for_stack[i].var == var)\n\
+\t{\n\
+\t  for_size = i;\n\
+\t  break;\n\
+\t}\n\
+    }\n\
+  if (stack_limit && ((unsigned long) for_size >= stack_limit))\n\
+    {\n\
+      printf (\"ERROR - FOR: LOOPS NESTED DEEPER THAN %lu\\n\",\n\
+\t      stack_limit);\n\
+      executing = 0;\n\
+      return 0;\n\
+    }\n\
+  if (for_size >= for_allocated)\n\
+    {\n\
+      for_allocated = for_allocated ? (for_allocated * 2) : 16;\n\
+      for_stack = realloc (for_stack, sizeof (*for_stack) * for_allocated);\n\
+    }\n\
+  for_stack[for_size].var = var;\n\
+  for_stack[for_size].gosub_level = gosub_level;\n\
+  for_stack[for_size++].id = id;\n\
+  return 1;\n\
+}\n\
+\n\
+static int next_loop (unsigned short var);\n\
+\n";
+
+/* NEXT for a variable; see evaluate_next() in run.c */
+static void
+emit_next_loop (void)
+{
+  char *initial, *limit, *step;
+  int id;
+
+  fputs ("/* Go on to the next iteration of the loop on a variable.\n"
+	 " * Returns the statement to continue the loop at, or -1\n"
+	 " * if the loop has finished (or there was an error). */\n"
+	 "static int\nnext_loop (unsigned short var)\n{\n"
+	 "  double to = 0.0, step = 0.0;\n  int i;\n\n"
+	 "  for (i = for_size - 1; i >= 0; --i)\n"
+	 "    if (for_stack[i].var == var)\n      break;\n"
+	 "  if (i < 0)\n    {\n"
+	 "      printf (\"ERROR - NEXT: NOT IN %s LOOP\\n\",\n"
+	 "\t      name_table[var]->contents);\n"
+	 "      executing = 0;\n      return -1;\n    }\n"
+	 "  for_size = i + 1;\n\n", out);
+  if (fixed_loop_limits)
+    /* FOR saved the limits */
+    fputs ("  to = for_stack[i].to;\n"
+	   "  step = for_stack[i].step;\n\n", out);
+  else
+    {
+      fputs ("  switch (for_stack[i].id)\n    {\n", out);
+      for (id = 0; id < num_statements; id++)
+	{
+	  if (statements[id]->command != FOR)
+	    continue;
+	  temp_count = 0;
+	  fprintf (out, "    case %d:\n      {\n", id);
+	  if (for_parts (id, &initial, &limit, &step) >= 0)
+	    fprintf (out, "\tto = %s;\n\tstep = %s;\n", limit, step);
+	  free (initial);
+	  free (limit);
+	  free (step);
+	  fputs ("      }\n      break;\n", out);
+	}
+      fputs ("    }\n\n", out);
+    }
+  fputs ("  V(var) += step;\n"
+	 "  if ((step >= 0.0) ? (V(var) <= to) : (V(var) >= to))\n"
+	 "    return for_stack[i].id + 1;\n"
+	 "  --for_size;\n  return -1;\n}\n\n", out);
+}
+
+/* Map a line number to its first statement, for computed GOTOs */
+static void
+emit_line_index (void)
+{
+  int i;
+
+  fputs ("/* Return the first statement of a line, or -1 */\n"
+	 "static int\nline_index (unsigned long number)\n{\n"
+	 "  switch (number)\n    {\n", out);
+  for (i = 0; i < num_lines; i++)
+    fprintf (out, "    case %luUL: return %d;\n",
+	     lines[i]->line_number, line_start[i]);
+  fputs ("    }\n  return -1;\n}\n\n", out);
+}
+
+static void
+emit_dispatcher (void)
+{
+  int id;
+
+  fputs ("\n dispatch:\n  switch (target)\n    {\n", out);
+  for (id = 0; id < num_statements; id++)
+    {
+      fprintf (out, "    case %d: ", id);
+      emit_jump ("", id);
+    }
+  fputs ("    }\n", out);
+}
+
+/* Write the program in memory out as a C program.
+ * Returns the number of statements which couldn't be translated. */
+int
+translate_program (FILE *to)
+{
+  int id;
+
+  out = to;
+  errors = 0;
+  scan_program ();
+  if (num_statements == 0)
+    {
+      fputs ("--emit-c: There is no program to translate\n", stderr);
+      return 1;
+    }
+
+  fputs ("/* Translated from BASIC by `basic --emit-c'.  Build with:\n"
+	 " *   cc -O2 -ffp-contract=off -I<BASIC source> prog.c"
+	 " libbasic.a -lfl -lm */\n\n"
+	 "#include <float.h>\n#include <math.h>\n#include <stdio.h>\n"
+	 "#include <stdlib.h>\n#include <string.h>\n"
+	 "#include \"tables.h\"\n\n", out);
+  fputs (preamble, out);
+  emit_data ();
+  fputs (arithmetic, out);
+  if (uses_gosub)
+    fputs (gosub_support, out);
+  if (uses_for)
+    fputs (for_support, out);
+  if (uses_line_index)
+    emit_line_index ();
+
+  fputs ("static void\nrun_program (void)\n{\n", out);
+  if (uses_dispatch)
+    fputs ("  int target;\n\n", out);
+  for (id = 0; id < num_statements; id++)
+    translate_statement (id);
+  fputs ("  goto done;\n", out);
+  if (uses_dispatch)
+    emit_dispatcher ();
+  fputs ("\n done:\n  return;\n}\n\n", out);
+
+  if (uses_for)
+    emit_next_loop ();
+
+  fputs ("/* Load the program into the interpreter's tables */\n"
+	 "static void\nload_program (void)\n{\n  int i;\n\n"
+	 "  /* Variables are referred to by their index in the name table */\n"
+	 "  for (i = 0; i < sizeof (names) / sizeof (names[0]); i++)\n"
+	 "    if (find_var_name (names[i]) != i)\n      {\n"
+	 "\tfprintf (stderr, \"Name table mismatch at %s\\n\", names[i]);\n"
+	 "\texit (1);\n      }\n"
+	 "  for (i = 0; i < sizeof (builtin_id) / sizeof (builtin_id[0]); i++)\n"
+	 "    builtin[i] = find_function (builtin_id[i])->built_in;\n"
+	 "  for (i = 0; i < NUM_LINES; i++)\n    {\n"
+	 "      unsigned short length;\n\n"
+	 "      memcpy (&length, line_data[i], sizeof (length));\n"
+	 "      program[i] = (struct line_header *) malloc (length);\n"
+	 "      memcpy (program[i], line_data[i], length);\n"
+	 "      add_line (program[i]);\n    }\n}\n\n"
+	 "int\nmain (int argc, char **argv)\n{\n"
+	 "  initialize_tables ();\n  load_program ();\n"
+	 "  executing = 1;\n  run_program ();\n  return 0;\n}\n", out);
+
+  free (lines);
+  free (line_start);
+  free (statements);
+  free (statement_line);
+  free (builtins);
+  return errors;
+}
@@ -4,6 +4,8 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "basic.tab.h"
 #include "tables.h"
 extern int yyparse (void);
@@ -24,13 +26,38 @@ main (int argc, char **argv)
 {
   int i, status;
   struct sigaction sa;
+  FILE *emit_c = NULL;
 
   i = 1;
   yydebug = 0;
   yy_flex_debug = 0;
-  // FIXME: Document this option and/or replace with getopt(3)
-  if ((i < argc) && (argv[i][0] == '-'))
+  // FIXME: Document these options and/or replace with getopt(3)
+  while ((i < argc) && (argv[i][0] == '-'))
     {
+      /* --emit-c: Translate the program to C instead of running it.
+       * Anything the interpreter prints while reading the program
+       * goes to stderr, leaving stdout for the C code. */
+      if (strcmp (argv[i], "--emit-c") == 0)
+	{
+	  fflush (stdout);
+	  emit_c = fdopen (dup (STDOUT_FILENO), "w");
+	  dup2 (STDERR_FILENO, STDOUT_FILENO);
+	}
+      /* -f: Always RUN programs with the bytecode engine */
+      if (argv[i][1] == 'f')
+	fast_default = 1;
+      /* -j: ... and compile hot expressions to native code */
+      if (argv[i][1] == 'j')
+	fast_default = jit_enabled = 1;
+      /* -l: Evaluate FOR loop limits only once, like Dartmouth BASIC */
+      if (argv[i][1] == 'l')
+	fixed_loop_limits = 1;
+      /* -s<depth>: Limit the nesting of GOSUBs and FOR loops (0: none) */
+      if (argv[i][1] == 's')
+	stack_limit = strtoul (&argv[i][2], NULL, 10);
+      /* -m<megabytes>: Limit the memory used by arrays (0: none) */
+      if (argv[i][1] == 'm')
+	array_memory_limit = strtoul (&argv[i][2], NULL, 10) << 20;
       if (argv[i][1] == 'd')
 	{
 	  if (argv[i][2] != 'l') {
@@ -77,5 +104,11 @@ main (int argc, char **argv)
 
   if (yyin != stdin)
     fclose (yyin);
+  if (emit_c != NULL)
+    {
+      status = translate_program (emit_c);
+      fclose (emit_c);
+      return (status != 0);
+    }
   return 0;
 }